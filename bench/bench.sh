@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# Time the specialized parser variants against the generic parser.
+#
+# usage: bench.sh [INIQ] [GENERIC_INIQ]
+#
+# GENERIC_INIQ is iniq built with -DINI_SPECIALIZE_PARSERS=0. Set RUNS to
+# change the number of runs per variant (default: 5) and SECTIONS to change
+# the size of the generated files (default: 20000 sections of 20 keys).
+
+set -e
+
+iniq=${1:-./iniq}
+generic=${2:-bench/iniq-generic}
+runs=${RUNS:-5}
+sections=${SECTIONS:-20000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# generate FILE SEP MULTI
+generate() {
+    awk -v n="$sections" -v sep="$2" -v multi="$3" 'BEGIN {
+        for (s = 0; s < n; s++) {
+            printf "[section%d]\n", s
+            for (k = 0; k < 20; k++) {
+                printf "key%d %s value %d ; comment\n", k, sep, k
+                if (multi && k % 5 == 0)
+                    printf "    continued value %d\n", k
+            }
+        }
+    }' > "$1"
+}
+
+# average milliseconds per run of a command
+time_runs() {
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$runs" ]; do
+        "$@" > /dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    echo $(((end - start) / 1000000 / runs))
+}
+
+# variant NAME FILE [OPTIONS...]
+variant() {
+    name=$1
+    file=$2
+    shift 2
+    last="section$((sections - 1)).key19"
+    g=$(time_runs "$generic" "$@" -p "$last" "$file")
+    s=$(time_runs "$iniq" "$@" -p "$last" "$file")
+    printf '%-20s %8s %8s %8s\n' "$name" "$g" "$s" \
+        "$(awk -v g="$g" -v s="$s" 'BEGIN {
+            printf "%.2fx", (s > 0 ? g / s : 0) }')"
+}
+
+generate "$tmp/default.ini" = 0
+generate "$tmp/custom.ini" '!' 0
+generate "$tmp/multi.ini" = 1
+
+printf '%-20s %8s %8s %8s\n' variant 'generic' 'special' speedup
+printf '%-20s %8s %8s %8s\n' '' '(ms)' '(ms)' ''
+variant 'default seps' "$tmp/default.ini"
+variant 'single sep' "$tmp/default.ini" -s =
+variant 'custom seps' "$tmp/custom.ini" -s '!$'
+variant 'multi default seps' "$tmp/multi.ini" -m
+variant 'multi single sep' "$tmp/multi.ini" -m -s =
+variant 'multi custom seps' "$tmp/multi.ini" -m -s '=!$'
@@ -0,0 +1,61 @@
+#!/bin/sh
+#
+# Time reading gzip-compressed files directly against piping them through
+# zcat.
+#
+# usage: gzip.sh [INIQ]
+#
+# INIQ must be built with ZLIB=1. Set RUNS to change the number of runs per
+# variant (default: 5) and SECTIONS to change the size of the generated file
+# (default: 20000 sections of 20 keys).
+
+set -e
+
+iniq=${1:-./iniq}
+runs=${RUNS:-5}
+sections=${SECTIONS:-20000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+awk -v n="$sections" 'BEGIN {
+    for (s = 0; s < n; s++) {
+        printf "[section%d]\n", s
+        for (k = 0; k < 20; k++)
+            printf "key%d = value %d ; comment\n", k, k
+    }
+}' > "$tmp/bench.ini"
+gzip -c "$tmp/bench.ini" > "$tmp/bench.ini.gz"
+
+last="section$((sections - 1)).key19"
+if ! "$iniq" -p "$last" "$tmp/bench.ini.gz" > /dev/null 2>&1; then
+    echo "$iniq can't read gzip-compressed files: build with ZLIB=1" >&2
+    exit 1
+fi
+
+# average milliseconds per run of a shell command
+time_runs() {
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$runs" ]; do
+        sh -c "$1" > /dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    echo $(((end - start) / 1000000 / runs))
+}
+
+# variant NAME OPTIONS
+variant() {
+    p=$(time_runs "zcat '$tmp/bench.ini.gz' | '$iniq' $2")
+    d=$(time_runs "'$iniq' $2 '$tmp/bench.ini.gz'")
+    printf '%-12s %8s %8s %8s\n' "$1" "$p" "$d" \
+        "$(awk -v p="$p" -v d="$d" 'BEGIN {
+            printf "%.2fx", (d > 0 ? p / d : 0) }')"
+}
+
+printf '%-12s %8s %8s %8s\n' query 'zcat |' direct speedup
+printf '%-12s %8s %8s %8s\n' '' '(ms)' '(ms)' ''
+variant 'last key' "-p $last"
+variant 'sections' ''
+variant 'output' '-o'
@@ -0,0 +1,129 @@
+// Measure INIReader lookup throughput across threads while the file is
+// reloaded continuously, with INIReloader and with a reader-writer lock
+// around a shared_ptr for comparison.
+//
+// usage: reload [THREADS] [SECONDS] [SECTIONS]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "../inih/cpp/INIReloader.h"
+
+using Clock = std::chrono::steady_clock;
+
+static const int KEYS = 20;
+
+struct Result {
+    double lookups; // per second, all threads
+    unsigned long reloads;
+};
+
+// Keys looked up by thread t, spread over the sections
+static void key(int t, unsigned long i, int sections, char* section, char* name)
+{
+    snprintf(section, 32, "section%lu", (i * 7 + t) % sections);
+    snprintf(name, 32, "key%lu", i % KEYS);
+}
+
+template <class Lookup, class Reload>
+static Result run(int threads, double seconds, int sections, Lookup lookup,
+                  Reload reload)
+{
+    std::atomic<bool> stop(false);
+    std::vector<unsigned long> counts(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            char section[32], name[32];
+            unsigned long n = 0;
+            long sum = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                key(t, n, sections, section, name);
+                sum += lookup(t, section, name);
+                n++;
+            }
+            // Use sum so the lookups aren't optimized away
+            counts[t] = n + (sum == -1);
+        });
+    }
+
+    Result r = {0, 0};
+    Clock::time_point start = Clock::now();
+    while (Clock::now() - start < std::chrono::duration<double>(seconds)) {
+        reload();
+        r.reloads++;
+    }
+    stop = true;
+    for (std::thread& w : workers)
+        w.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    for (int t = 0; t < threads; t++)
+        r.lookups += counts[t];
+    r.lookups /= elapsed;
+    return r;
+}
+
+int main(int argc, char** argv)
+{
+    int threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+    double seconds = argc > 2 ? atof(argv[2]) : 2;
+    int sections = argc > 3 ? atoi(argv[3]) : 1000;
+
+    char path[] = "/tmp/reload-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    FILE* f = fdopen(fd, "w");
+    for (int s = 0; s < sections; s++) {
+        fprintf(f, "[section%d]\n", s);
+        for (int k = 0; k < KEYS; k++)
+            fprintf(f, "key%d = %d\n", k, s * KEYS + k);
+    }
+    fclose(f);
+
+    INIReloader reloader(path, threads);
+    std::vector<std::unique_ptr<INIReloader::Reader>> readers;
+    for (int t = 0; t < threads; t++)
+        readers.emplace_back(new INIReloader::Reader(reloader));
+    Result rcu = run(threads, seconds, sections,
+        [&](int t, const char* section, const char* name) {
+            INIReloader::Snapshot s = readers[t]->Read();
+            return s->GetInteger(section, name, -1);
+        },
+        [&] { reloader.Reload(); });
+
+    std::shared_mutex lock;
+    std::shared_ptr<const INIReader> current(new INIReader(path));
+    Result locked = run(threads, seconds, sections,
+        [&](int, const char* section, const char* name) {
+            std::shared_ptr<const INIReader> s;
+            {
+                std::shared_lock<std::shared_mutex> guard(lock);
+                s = current;
+            }
+            return s->GetInteger(section, name, -1);
+        },
+        [&] {
+            std::shared_ptr<const INIReader> next(new INIReader(path));
+            std::unique_lock<std::shared_mutex> guard(lock);
+            current = next;
+        });
+
+    unlink(path);
+    printf("%d threads, %d sections of %d keys, %.1fs each\n", threads,
+           sections, KEYS, seconds);
+    printf("%-12s %14s %14s %8s\n", "", "lookups/s", "per thread", "reloads");
+    printf("%-12s %14.0f %14.0f %8lu\n", "INIReloader", rcu.lookups,
+           rcu.lookups / threads, rcu.reloads);
+    printf("%-12s %14.0f %14.0f %8lu\n", "rwlock", locked.lookups,
+           locked.lookups / threads, locked.reloads);
+    return 0;
+}
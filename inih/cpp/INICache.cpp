@@ -0,0 +1,112 @@
+// Keep recently used INI files parsed within a memory budget.
+
+// SPDX-License-Identifier: BSD-3-Clause
+
+// inih and INIReader are released under the New BSD license (see LICENSE.txt).
+// Go to the project home page for more info:
+//
+// https://github.com/benhoyt/inih
+
+#include <unistd.h>
+#include "INICache.h"
+
+using std::shared_ptr;
+using std::string;
+
+INICache::Identity::Identity(const struct stat& st)
+    : dev(st.st_dev), ino(st.st_ino), size(st.st_size), mtime(st.st_mtim),
+      ctime(st.st_ctim)
+{
+}
+
+bool INICache::Identity::operator==(const Identity& other) const
+{
+    return dev == other.dev && ino == other.ino && size == other.size &&
+           mtime.tv_sec == other.mtime.tv_sec &&
+           mtime.tv_nsec == other.mtime.tv_nsec &&
+           ctime.tv_sec == other.ctime.tv_sec &&
+           ctime.tv_nsec == other.ctime.tv_nsec;
+}
+
+INICache::INICache(size_t budget)
+    : _budget(budget), _stats{0, 0, 0, 0, 0}
+{
+}
+
+shared_ptr<const INIReader> INICache::Get(const string& path, int dirfd)
+{
+    string key = Key(path, dirfd);
+    struct stat st;
+
+    if (fstatat(dirfd, path.c_str(), &st, 0) == 0) {
+        std::lock_guard<std::mutex> guard(_lock);
+        auto it = _entries.find(key);
+        if (it != _entries.end() && it->second->identity == Identity(st)) {
+            _lru.splice(_lru.begin(), _lru, it->second);
+            _stats.hits++;
+            return it->second->reader;
+        }
+    }
+
+    // Parse outside the lock, taking the identity from the descriptor that
+    // is read so a file replaced meanwhile isn't cached under the old one
+    int fd = openat(dirfd, path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0)
+            close(fd);
+        Forget(path, dirfd);
+        return std::make_shared<const INIReader>(-1);
+    }
+    shared_ptr<const INIReader> reader = std::make_shared<const INIReader>(fd);
+    close(fd);
+
+    std::lock_guard<std::mutex> guard(_lock);
+    _stats.misses++;
+    auto it = _entries.find(key);
+    if (it != _entries.end())
+        Erase(it->second);
+
+    size_t bytes = reader->MemoryUsage() + sizeof(Entry) + 2 * key.size();
+    if (bytes > _budget)
+        return reader;
+
+    _lru.push_front(Entry{key, Identity(st), reader, bytes});
+    _entries.emplace(key, _lru.begin());
+    _stats.entries++;
+    _stats.bytes += bytes;
+    while (_stats.bytes > _budget) {
+        Erase(std::prev(_lru.end()));
+        _stats.evictions++;
+    }
+    return reader;
+}
+
+void INICache::Forget(const string& path, int dirfd)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    auto it = _entries.find(Key(path, dirfd));
+    if (it != _entries.end())
+        Erase(it->second);
+}
+
+INICache::Stats INICache::GetStats() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _stats;
+}
+
+string INICache::Key(const string& path, int dirfd)
+{
+    // Relative paths are only the same file under the same directory
+    if (dirfd == AT_FDCWD || (!path.empty() && path[0] == '/'))
+        return path;
+    return std::to_string(dirfd) + ":" + path;
+}
+
+void INICache::Erase(List::iterator it)
+{
+    _stats.entries--;
+    _stats.bytes -= it->bytes;
+    _entries.erase(it->key);
+    _lru.erase(it);
+}
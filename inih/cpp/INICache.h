@@ -0,0 +1,91 @@
+// Keep recently used INI files parsed within a memory budget.
+
+// SPDX-License-Identifier: BSD-3-Clause
+
+// inih and INIReader are released under the New BSD license (see LICENSE.txt).
+// Go to the project home page for more info:
+//
+// https://github.com/benhoyt/inih
+
+#ifndef __INICACHE_H__
+#define __INICACHE_H__
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "INIReader.h"
+
+// Cache of parsed files for long-lived processes that read the same files
+// again and again. A file is keyed by its path and checked against the
+// identity it had when parsed (device, inode, size, modification and change
+// times), so a cached reader is revalidated with one fstatat() call instead
+// of a parse. Readers are charged their INIReader::MemoryUsage(), and the
+// least recently used are evicted to stay within the budget. All methods are
+// thread-safe.
+class INICache
+{
+public:
+    struct Stats {
+        uint64_t hits;      // Get() found an unchanged cached reader
+        uint64_t misses;    // Get() parsed the file
+        uint64_t evictions; // readers dropped to stay within the budget
+        size_t entries;     // readers cached now
+        size_t bytes;       // memory charged to them
+    };
+
+    // Construct a cache holding at most budget bytes of readers.
+    explicit INICache(size_t budget);
+    INICache(const INICache&) = delete;
+    INICache& operator=(const INICache&) = delete;
+
+    // Return the parsed file at path, relative to dirfd if it isn't absolute.
+    // The reader is shared, and stays valid after it's evicted or the file
+    // changes. A file that can't be opened gives a reader whose ParseError()
+    // is -1, and isn't cached. A reader bigger than the whole budget is
+    // returned but not kept.
+    std::shared_ptr<const INIReader> Get(const std::string& path,
+                                         int dirfd = AT_FDCWD);
+
+    // Drop the cached reader of path, if any.
+    void Forget(const std::string& path, int dirfd = AT_FDCWD);
+
+    Stats GetStats() const;
+
+private:
+    // What a file looked like when it was parsed
+    struct Identity {
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        struct timespec mtime;
+        struct timespec ctime;
+
+        explicit Identity(const struct stat& st);
+        bool operator==(const Identity& other) const;
+    };
+
+    struct Entry {
+        std::string key;
+        Identity identity;
+        std::shared_ptr<const INIReader> reader;
+        size_t bytes;
+    };
+
+    typedef std::list<Entry> List;
+
+    size_t _budget;
+    mutable std::mutex _lock;
+    List _lru; // most recently used first
+    std::unordered_map<std::string, List::iterator> _entries;
+    Stats _stats;
+
+    static std::string Key(const std::string& path, int dirfd);
+    void Erase(List::iterator it);
+};
+
+#endif  // __INICACHE_H__
@@ -9,17 +9,57 @@
 //
 // https://github.com/benhoyt/inih
 
-#include <algorithm>
-#include <cctype>
+#include <cstdio>
 #include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "../ini.h"
 #include "INIReader.h"
 
 using std::string;
+using std::string_view;
+
+// Bits of Cache::state for each conversion, shifted by its CACHE_* offset
+enum {
+    CACHE_BUSY = 1,  // a reader has claimed the conversion
+    CACHE_DONE = 2,  // the conversion is written
+    CACHE_VALID = 4, // the value converted successfully
+};
+
+enum {
+    CACHE_INTEGER = 0,
+    CACHE_REAL = 3,
+    CACHE_BOOLEAN = 6,
+};
+
+// Fold an ASCII letter to lower case to make section/name lookups
+// case-insensitive
+static inline unsigned char Fold(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
 
 INIReader::INIReader(const string& filename)
 {
-    _error = ini_parse(filename.c_str(), ValueHandler, this);
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        _error = -1;
+        return;
+    }
+    _error = ParseFd(fd);
+    close(fd);
+}
+
+INIReader::INIReader(const char* buffer, size_t length)
+{
+    _error = ParseBuffer(buffer, length);
+}
+
+INIReader::INIReader(int fd)
+{
+    _error = ParseFd(fd);
 }
 
 int INIReader::ParseError() const
@@ -27,82 +67,399 @@ int INIReader::ParseError() const
     return _error;
 }
 
-string INIReader::Get(const string& section, const string& name, const string& default_value) const
+string INIReader::Get(string_view section, string_view name, string_view default_value) const
+{
+    const string* value = FindValue(section, name);
+    return value ? *value : string(default_value);
+}
+
+string INIReader::GetString(string_view section, string_view name, string_view default_value) const
+{
+    const string* value = FindValue(section, name);
+    return value && !value->empty() ? *value : string(default_value);
+}
+
+long INIReader::GetInteger(string_view section, string_view name, long default_value) const
+{
+    const Value* v = FindEntry(section, name);
+    long n;
+    return v && Convert(*v, &Cache::integer, CACHE_INTEGER, n) ? n : default_value;
+}
+
+double INIReader::GetReal(string_view section, string_view name, double default_value) const
+{
+    const Value* v = FindEntry(section, name);
+    double n;
+    return v && Convert(*v, &Cache::real, CACHE_REAL, n) ? n : default_value;
+}
+
+bool INIReader::GetBoolean(string_view section, string_view name, bool default_value) const
 {
-    string key = MakeKey(section, name);
-    // Use _values.find() here instead of _values.at() to support pre C++11 compilers
-    return _values.count(key) ? _values.find(key)->second : default_value;
+    const Value* v = FindEntry(section, name);
+    bool b;
+    return v && Convert(*v, &Cache::boolean, CACHE_BOOLEAN, b) ? b : default_value;
 }
 
-string INIReader::GetString(const string& section, const string& name, const string& default_value) const
+bool INIReader::HasSection(string_view section) const
 {
-    const string str = Get(section, name, "");
-    return str.empty() ? default_value : str;
+    return _sections.Find(section, FoldHash(section)) != NULL;
 }
 
-long INIReader::GetInteger(const string& section, const string& name, long default_value) const
+bool INIReader::HasValue(string_view section, string_view name) const
 {
-    string valstr = Get(section, name, "");
-    const char* value = valstr.c_str();
+    return FindValue(section, name) != NULL;
+}
+
+INIReader::Binding::Binding(string_view section, string_view name, string* dest)
+    : section(section), name(name), section_hash(FoldHash(section)),
+      name_hash(FoldHash(name)), type(String), dest(dest)
+{
+}
+
+INIReader::Binding::Binding(string_view section, string_view name, long* dest)
+    : section(section), name(name), section_hash(FoldHash(section)),
+      name_hash(FoldHash(name)), type(Integer), dest(dest)
+{
+}
+
+INIReader::Binding::Binding(string_view section, string_view name, double* dest)
+    : section(section), name(name), section_hash(FoldHash(section)),
+      name_hash(FoldHash(name)), type(Real), dest(dest)
+{
+}
+
+INIReader::Binding::Binding(string_view section, string_view name, bool* dest)
+    : section(section), name(name), section_hash(FoldHash(section)),
+      name_hash(FoldHash(name)), type(Boolean), dest(dest)
+{
+}
+
+size_t INIReader::Bind(const std::vector<Binding>& bindings) const
+{
+    const Binding* prev = NULL;
+    const Section* s = NULL;
+    size_t count = 0;
+
+    for (const Binding& b : bindings) {
+        if (!prev || b.section_hash != prev->section_hash ||
+            !FoldEqual(b.section, prev->section))
+            s = _sections.Find(b.section, b.section_hash);
+        prev = &b;
+
+        const Value* v = s ? s->values.Find(b.name, b.name_hash) : NULL;
+        if (!v)
+            continue;
+
+        switch (b.type) {
+        case Binding::String:
+            *static_cast<string*>(b.dest) = v->value;
+            count++;
+            break;
+        case Binding::Integer:
+            count += Convert(*v, &Cache::integer, CACHE_INTEGER,
+                             *static_cast<long*>(b.dest));
+            break;
+        case Binding::Real:
+            count += Convert(*v, &Cache::real, CACHE_REAL,
+                             *static_cast<double*>(b.dest));
+            break;
+        case Binding::Boolean:
+            count += Convert(*v, &Cache::boolean, CACHE_BOOLEAN,
+                             *static_cast<bool*>(b.dest));
+            break;
+        }
+    }
+
+    return count;
+}
+
+std::vector<string_view> INIReader::FindSections(string_view name,
+                                                 string_view value) const
+{
+    const ValueIndex* index =
+        _value_index.index.load(std::memory_order_acquire);
+    if (!index) {
+        // Readers racing to build the index each build the same one, and
+        // the first published is kept
+        ValueIndex* built = new ValueIndex();
+        for (size_t i = 0; i < _sections.items.size(); i++) {
+            for (const Value& v : _sections.items[i].values.items)
+                (*built)[ValueHash(v.hash, v.value)].push_back((uint32_t)i);
+        }
+        if (_value_index.index.compare_exchange_strong(
+                index, built, std::memory_order_acq_rel)) {
+            index = built;
+        } else {
+            delete built;
+        }
+    }
+
+    std::vector<string_view> found;
+    size_t name_hash = FoldHash(name);
+    auto it = index->find(ValueHash(name_hash, value));
+    if (it == index->end())
+        return found;
+    for (uint32_t i : it->second) {
+        const Section& s = _sections.items[i];
+        const Value* v = s.values.Find(name, name_hash);
+        // A section is only listed again if another of its values has the
+        // same hash
+        if (v && v->value == value &&
+            (found.empty() || found.back().data() != s.name.data()))
+            found.push_back(s.name);
+    }
+    return found;
+}
+
+size_t INIReader::MemoryUsage() const
+{
+    size_t size = sizeof(*this);
+    size += _sections.items.capacity() * sizeof(Section) +
+            _sections.slots.capacity() * sizeof(uint32_t);
+    for (const Section& s : _sections.items) {
+        size += HeapSize(s.name);
+        size += s.values.items.capacity() * sizeof(Value) +
+                s.values.slots.capacity() * sizeof(uint32_t);
+        for (const Value& v : s.values.items)
+            size += HeapSize(v.name) + HeapSize(v.value);
+    }
+    const ValueIndex* index =
+        _value_index.index.load(std::memory_order_acquire);
+    if (index) {
+        size += index->bucket_count() * sizeof(void*);
+        for (const auto& entry : *index) {
+            size += sizeof(entry) + sizeof(void*) +
+                    entry.second.capacity() * sizeof(uint32_t);
+        }
+    }
+    return size;
+}
+
+template <class T>
+size_t INIReader::Table<T>::Slot(string_view name, size_t hash) const
+{
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    for (; slots[i]; i = (i + 1) & mask) {
+        const T& item = items[slots[i] - 1];
+        if (item.hash == hash && FoldEqual(item.name, name))
+            break;
+    }
+    return i;
+}
+
+template <class T>
+const T* INIReader::Table<T>::Find(string_view name, size_t hash) const
+{
+    if (slots.empty())
+        return NULL;
+    size_t i = Slot(name, hash);
+    return slots[i] ? &items[slots[i] - 1] : NULL;
+}
+
+template <class T>
+T& INIReader::Table<T>::Insert(string_view name, size_t hash)
+{
+    size_t i = 0;
+    if (!slots.empty() && slots[i = Slot(name, hash)])
+        return items[slots[i] - 1];
+
+    // Keep the table at most half full so probe sequences stay short
+    if ((items.size() + 1) * 2 > slots.size()) {
+        std::vector<uint32_t> grown(slots.empty() ? 8 : slots.size() * 2, 0);
+        size_t mask = grown.size() - 1;
+        for (size_t n = 0; n < items.size(); n++) {
+            size_t j = items[n].hash & mask;
+            while (grown[j])
+                j = (j + 1) & mask;
+            grown[j] = (uint32_t)(n + 1);
+        }
+        slots.swap(grown);
+        i = Slot(name, hash);
+    }
+
+    items.push_back(T());
+    items.back().name = string(name);
+    items.back().hash = hash;
+    slots[i] = (uint32_t)items.size();
+    return items.back();
+}
+
+const INIReader::Value* INIReader::FindEntry(string_view section, string_view name) const
+{
+    const Section* s = _sections.Find(section, FoldHash(section));
+    return s ? s->values.Find(name, FoldHash(name)) : NULL;
+}
+
+const string* INIReader::FindValue(string_view section, string_view name) const
+{
+    const Value* v = FindEntry(section, name);
+    return v ? &v->value : NULL;
+}
+
+INIReader::Cache& INIReader::Cache::operator=(const Cache& other) noexcept
+{
+    // A conversion another reader has claimed but not yet published may be
+    // half written, so it's left for the copy to redo
+    unsigned seen = other.state.load(std::memory_order_acquire);
+    unsigned copied = 0;
+    for (unsigned shift : {CACHE_INTEGER, CACHE_REAL, CACHE_BOOLEAN}) {
+        if (seen & (CACHE_DONE << shift))
+            copied |= seen & ((CACHE_BUSY | CACHE_DONE | CACHE_VALID) << shift);
+    }
+    if (copied & (CACHE_DONE << CACHE_INTEGER))
+        integer = other.integer;
+    if (copied & (CACHE_DONE << CACHE_REAL))
+        real = other.real;
+    if (copied & (CACHE_DONE << CACHE_BOOLEAN))
+        boolean = other.boolean;
+    state.store(copied, std::memory_order_release);
+    return *this;
+}
+
+template <class T>
+bool INIReader::Convert(const Value& v, T Cache::*cached, unsigned shift, T& out)
+{
+    unsigned state = v.cache.state.load(std::memory_order_acquire);
+    if (state & (CACHE_DONE << shift)) {
+        if (!(state & (CACHE_VALID << shift)))
+            return false;
+        out = v.cache.*cached;
+        return true;
+    }
+
+    T result;
+    bool valid = Parse(v.value, result);
+    // Only the reader that claims the conversion writes it; others racing
+    // with it just use their own result
+    if (!(v.cache.state.fetch_or(CACHE_BUSY << shift, std::memory_order_acquire) &
+          (CACHE_BUSY << shift))) {
+        v.cache.*cached = result;
+        v.cache.state.fetch_or((CACHE_DONE | (valid ? CACHE_VALID : 0)) << shift,
+                               std::memory_order_release);
+    }
+    if (valid)
+        out = result;
+    return valid;
+}
+
+bool INIReader::Parse(const string& str, long& out)
+{
+    const char* value = str.c_str();
     char* end;
     // This parses "1234" (decimal) and also "0x4D2" (hex)
-    long n = strtol(value, &end, 0);
-    return end > value ? n : default_value;
+    out = strtol(value, &end, 0);
+    return end > value;
 }
 
-double INIReader::GetReal(const string& section, const string& name, double default_value) const
+bool INIReader::Parse(const string& str, double& out)
 {
-    string valstr = Get(section, name, "");
-    const char* value = valstr.c_str();
+    const char* value = str.c_str();
     char* end;
-    double n = strtod(value, &end);
-    return end > value ? n : default_value;
+    out = strtod(value, &end);
+    return end > value;
 }
 
-bool INIReader::GetBoolean(const string& section, const string& name, bool default_value) const
+bool INIReader::Parse(const string& str, bool& out)
 {
-    string valstr = Get(section, name, "");
-    // Convert to lower case to make string comparisons case-insensitive
-    std::transform(valstr.begin(), valstr.end(), valstr.begin(), ::tolower);
-    if (valstr == "true" || valstr == "yes" || valstr == "on" || valstr == "1")
-        return true;
-    else if (valstr == "false" || valstr == "no" || valstr == "off" || valstr == "0")
-        return false;
+    // Compare without case instead of converting a copy to lower case
+    if (FoldEqual(str, "true") || FoldEqual(str, "yes") ||
+        FoldEqual(str, "on") || str == "1")
+        out = true;
+    else if (FoldEqual(str, "false") || FoldEqual(str, "no") ||
+             FoldEqual(str, "off") || str == "0")
+        out = false;
     else
-        return default_value;
+        return false;
+    return true;
 }
 
-bool INIReader::HasSection(const string& section) const
+size_t INIReader::HeapSize(const string& str)
 {
-    const string key = MakeKey(section, "");
-    std::map<string, string>::const_iterator pos = _values.lower_bound(key);
-    if (pos == _values.end())
+    // Short strings are stored inside the string object itself
+    const char* p = str.data();
+    const char* self = reinterpret_cast<const char*>(&str);
+    if (p >= self && p < self + sizeof(str))
+        return 0;
+    return str.capacity() + 1;
+}
+
+size_t INIReader::FoldHash(string_view str)
+{
+    // 64-bit FNV-1a of the case-folded string
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : str) {
+        hash ^= Fold(c);
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)(hash ^ (hash >> 32));
+}
+
+size_t INIReader::ValueHash(size_t name_hash, string_view value)
+{
+    // Values are compared exactly, unlike names
+    return name_hash * 0x9E3779B97F4A7C15ULL ^ std::hash<string_view>()(value);
+}
+
+bool INIReader::FoldEqual(string_view a, string_view b)
+{
+    if (a.size() != b.size())
         return false;
-    // Does the key at the lower_bound pos start with "section"?
-    return pos->first.compare(0, key.length(), key) == 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (Fold(a[i]) != Fold(b[i]))
+            return false;
+    }
+    return true;
 }
 
-bool INIReader::HasValue(const string& section, const string& name) const
+int INIReader::ParseBuffer(const char* buffer, size_t length)
 {
-    string key = MakeKey(section, name);
-    return _values.count(key);
+    ini_parser_config config = {NULL, 0, 0};
+    return ini_parse_buffer(buffer, length, ValueHandler, config, this);
 }
 
-string INIReader::MakeKey(const string& section, const string& name)
+int INIReader::ParseFd(int fd)
 {
-    string key = section + "=" + name;
-    // Convert to lower case to make section/name lookups case-insensitive
-    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-    return key;
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return -1;
+
+    // Parse a regular file where it's mapped rather than copying it
+    off_t offset = S_ISREG(st.st_mode) ? lseek(fd, 0, SEEK_CUR) : -1;
+    if (offset >= 0 && offset < st.st_size) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            int error = ParseBuffer(static_cast<const char*>(map) + offset,
+                                    st.st_size - offset);
+            munmap(map, st.st_size);
+            lseek(fd, st.st_size, SEEK_SET);
+            return error;
+        }
+    }
+
+    // Pipes, sockets and files that can't be mapped are read whole
+    string data;
+    char chunk[BUFSIZ];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+        data.append(chunk, n);
+    if (n < 0)
+        return -1;
+    return ParseBuffer(data.data(), data.size());
 }
 
 int INIReader::ValueHandler(void* user, const char* section, const char* name,
                             const char* value)
 {
+    // Sections only exist once they have a name=value pair
+    if (!name)
+        return 1;
     INIReader* reader = static_cast<INIReader*>(user);
-    string key = MakeKey(section, name);
-    if (reader->_values[key].size() > 0)
-        reader->_values[key] += "\n";
-    reader->_values[key] += value;
+    Section& s = reader->_sections.Insert(section, FoldHash(section));
+    Value& v = s.values.Insert(name, FoldHash(name));
+    if (v.value.size() > 0)
+        v.value += "\n";
+    v.value += value ? value : "";
     return 1;
 }
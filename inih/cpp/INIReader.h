@@ -12,56 +12,207 @@
 #ifndef __INIREADER_H__
 #define __INIREADER_H__
 
-#include <map>
+#include <atomic>
+#include <cstdint>
 #include <string>
-
-// Read an INI file into easy-to-access name/value pairs. (Note that I've gone
-// for simplicity here rather than speed, but it should be pretty decent.)
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Read an INI file into easy-to-access name/value pairs. Section and name
+// lookups are case-insensitive and take std::string_view, so looking a value
+// up never allocates. Values converted by the typed getters are cached, so
+// each is only converted once. Requires C++17.
 class INIReader
 {
 public:
+    // Destination for Bind(): the value of name in section, converted to the
+    // type dest points to. Section and name must outlive the binding, and
+    // their hashes are computed once so a list of bindings can be reused.
+    struct Binding {
+        enum Type { String, Integer, Real, Boolean };
+
+        Binding(std::string_view section, std::string_view name, std::string* dest);
+        Binding(std::string_view section, std::string_view name, long* dest);
+        Binding(std::string_view section, std::string_view name, double* dest);
+        Binding(std::string_view section, std::string_view name, bool* dest);
+
+        std::string_view section;
+        std::string_view name;
+        size_t section_hash;
+        size_t name_hash;
+        Type type;
+        void* dest;
+    };
+
     // Construct INIReader and parse given filename. See ini.h for more info
-    // about the parsing.
+    // about the parsing. A regular file is mapped into memory and parsed in
+    // place, anything else is read through stdio.
     explicit INIReader(const std::string& filename);
 
+    // Construct INIReader and parse the length bytes of INI data in buffer,
+    // which needn't be null-terminated. Take a std::string_view as
+    // INIReader(view.data(), view.size()).
+    INIReader(const char* buffer, size_t length);
+
+    // Construct INIReader and parse the INI data read from the open file
+    // descriptor fd, from its current offset. The descriptor is left open.
+    // ParseError() is -1 if fd can't be read.
+    explicit INIReader(int fd);
+
+    // Moving a reader hands over its values without copying them, and leaves
+    // the source with no sections. Copying copies every value.
+    INIReader(const INIReader&) = default;
+    INIReader(INIReader&&) noexcept = default;
+    INIReader& operator=(const INIReader&) = default;
+    INIReader& operator=(INIReader&&) noexcept = default;
+
     // Return the result of ini_parse(), i.e., 0 on success, line number of
     // first error on parse error, or -1 on file open error.
     int ParseError() const;
 
     // Get a string value from INI file, returning default_value if not found.
-    std::string Get(const std::string& section, const std::string& name,
-                    const std::string& default_value) const;
+    std::string Get(std::string_view section, std::string_view name,
+                    std::string_view default_value) const;
 
     // Get a string value from INI file, returning default_value if not found,
     // empty, or contains only whitespace.
-    std::string GetString(const std::string& section, const std::string& name,
-                    const std::string& default_value) const;
+    std::string GetString(std::string_view section, std::string_view name,
+                          std::string_view default_value) const;
 
     // Get an integer (long) value from INI file, returning default_value if
     // not found or not a valid integer (decimal "1234", "-1234", or hex "0x4d2").
-    long GetInteger(const std::string& section, const std::string& name, long default_value) const;
+    long GetInteger(std::string_view section, std::string_view name, long default_value) const;
 
     // Get a real (floating point double) value from INI file, returning
     // default_value if not found or not a valid floating point value
     // according to strtod().
-    double GetReal(const std::string& section, const std::string& name, double default_value) const;
+    double GetReal(std::string_view section, std::string_view name, double default_value) const;
 
     // Get a boolean value from INI file, returning default_value if not found or if
     // not a valid true/false value. Valid true values are "true", "yes", "on", "1",
     // and valid false values are "false", "no", "off", "0" (not case sensitive).
-    bool GetBoolean(const std::string& section, const std::string& name, bool default_value) const;
+    bool GetBoolean(std::string_view section, std::string_view name, bool default_value) const;
 
     // Return true if the given section exists (section must contain at least
     // one name=value pair).
-    bool HasSection(const std::string& section) const;
+    bool HasSection(std::string_view section) const;
 
     // Return true if a value exists with the given section and field names.
-    bool HasValue(const std::string& section, const std::string& name) const;
+    bool HasValue(std::string_view section, std::string_view name) const;
+
+    // Set each destination in bindings to its value, converted as the typed
+    // getters do, in one pass. Destinations whose value is missing or not
+    // valid are left alone, so they can be set to defaults beforehand.
+    // Consecutive bindings in the same section share its lookup. Return the
+    // number of destinations set.
+    size_t Bind(const std::vector<Binding>& bindings) const;
+
+    // Return the sections, in file order, where name has exactly value. The
+    // first call indexes every value by its name, so later calls take time
+    // proportional to the number of sections found. The views point into the
+    // reader and are valid as long as it is.
+    std::vector<std::string_view> FindSections(std::string_view name,
+                                               std::string_view value) const;
+
+    // Return the number of bytes the reader holds, counting its tables and
+    // the strings that don't fit inside them.
+    size_t MemoryUsage() const;
 
 private:
+    // Open-addressing hash table of items in insertion order, each with a
+    // name and the hash of its case-folded name.
+    template <class T>
+    struct Table {
+        std::vector<T> items;
+        std::vector<uint32_t> slots; // index + 1 of an item, 0 if empty
+
+        // Return the slot holding name, or the empty slot where it goes
+        size_t Slot(std::string_view name, size_t hash) const;
+        const T* Find(std::string_view name, size_t hash) const;
+        T& Insert(std::string_view name, size_t hash);
+    };
+
+    // Conversions of a value for the typed getters, each filled in the first
+    // time it's asked for. The first reader to claim a conversion writes it
+    // and publishes it in state, so concurrent readers are safe. Copying
+    // takes only the conversions already published.
+    struct Cache {
+        std::atomic<unsigned> state;
+        long integer;
+        double real;
+        bool boolean;
+
+        Cache() : state(0), integer(0), real(0), boolean(false) {}
+        Cache(const Cache& other) noexcept : Cache() { *this = other; }
+        Cache& operator=(const Cache& other) noexcept;
+    };
+
+    struct Value {
+        std::string name;
+        size_t hash;
+        std::string value;
+        mutable Cache cache;
+    };
+
+    struct Section {
+        std::string name;
+        size_t hash;
+        Table<Value> values;
+    };
+
+    // Indexes of the sections holding each name and value, keyed by the
+    // hash of both. Sections that only share the hash are skipped when
+    // looking up.
+    typedef std::unordered_map<size_t, std::vector<uint32_t>> ValueIndex;
+
+    // A ValueIndex built by the first FindSections() and published with a
+    // compare-and-swap, so concurrent readers are safe. Copying loads the
+    // pointer atomically and copies the index, as it does the values.
+    struct LazyIndex {
+        std::atomic<const ValueIndex*> index;
+
+        LazyIndex() : index(nullptr) {}
+        LazyIndex(const LazyIndex& other) : index(other.Copy()) {}
+        LazyIndex(LazyIndex&& other) noexcept
+            : index(other.index.exchange(nullptr)) {}
+        LazyIndex& operator=(const LazyIndex& other)
+        {
+            if (this != &other)
+                delete index.exchange(other.Copy());
+            return *this;
+        }
+        LazyIndex& operator=(LazyIndex&& other) noexcept
+        {
+            if (this != &other)
+                delete index.exchange(other.index.exchange(nullptr));
+            return *this;
+        }
+        ~LazyIndex() { delete index.load(); }
+
+        const ValueIndex* Copy() const
+        {
+            const ValueIndex* i = index.load(std::memory_order_acquire);
+            return i ? new ValueIndex(*i) : nullptr;
+        }
+    };
+
     int _error;
-    std::map<std::string, std::string> _values;
-    static std::string MakeKey(const std::string& section, const std::string& name);
+    Table<Section> _sections;
+    mutable LazyIndex _value_index;
+    const Value* FindEntry(std::string_view section, std::string_view name) const;
+    const std::string* FindValue(std::string_view section, std::string_view name) const;
+    template <class T>
+    static bool Convert(const Value& v, T Cache::*cached, unsigned shift, T& out);
+    static bool Parse(const std::string& str, long& out);
+    static bool Parse(const std::string& str, double& out);
+    static bool Parse(const std::string& str, bool& out);
+    static size_t HeapSize(const std::string& str);
+    static size_t FoldHash(std::string_view str);
+    static size_t ValueHash(size_t name_hash, std::string_view value);
+    static bool FoldEqual(std::string_view a, std::string_view b);
+    int ParseBuffer(const char* buffer, size_t length);
+    int ParseFd(int fd);
     static int ValueHandler(void* user, const char* section, const char* name,
                             const char* value);
 };
@@ -0,0 +1,121 @@
+// Share an INIReader between threads and reload it without stopping them.
+
+// SPDX-License-Identifier: BSD-3-Clause
+
+// inih and INIReader are released under the New BSD license (see LICENSE.txt).
+// Go to the project home page for more info:
+//
+// https://github.com/benhoyt/inih
+
+#include <cassert>
+#include <stdexcept>
+#include "INIReloader.h"
+
+using std::string;
+
+INIReloader::Snapshot::Snapshot(std::atomic<uint64_t>* slot, const INIReader* reader)
+    : _slot(slot), _reader(reader)
+{
+}
+
+INIReloader::Snapshot::Snapshot(Snapshot&& other) noexcept
+    : _slot(other._slot), _reader(other._reader)
+{
+    other._slot = NULL;
+}
+
+INIReloader::Snapshot::~Snapshot()
+{
+    // Leaving the epoch lets Reload() free the snapshots older than it
+    if (_slot)
+        _slot->store(0, std::memory_order_release);
+}
+
+INIReloader::Reader::Reader(INIReloader& reloader)
+    : _reloader(reloader)
+{
+    std::lock_guard<std::mutex> guard(reloader._lock);
+    for (_slot = 0; _slot < reloader._max_readers; _slot++) {
+        if (!reloader._slots[_slot].used) {
+            reloader._slots[_slot].used = true;
+            return;
+        }
+    }
+    throw std::length_error("INIReloader: too many readers");
+}
+
+INIReloader::Reader::~Reader()
+{
+    assert(_reloader._slots[_slot].epoch.load() == 0 &&
+           "INIReloader: Reader destroyed while its Snapshot is alive");
+    std::lock_guard<std::mutex> guard(_reloader._lock);
+    _reloader._slots[_slot].used = false;
+}
+
+INIReloader::Snapshot INIReloader::Reader::Read()
+{
+    std::atomic<uint64_t>& epoch = _reloader._slots[_slot].epoch;
+    // A second Snapshot would overwrite the first one's epoch, and the first
+    // one's destructor would then unpin both
+    assert(epoch.load(std::memory_order_relaxed) == 0 &&
+           "INIReloader: Reader already holds a Snapshot");
+    // Announce the epoch before loading the pointer: a Reload() that swaps
+    // the pointer after this load sees the announcement and waits for it
+    epoch.store(_reloader._epoch.load(std::memory_order_acquire));
+    return Snapshot(&epoch, _reloader._current.load());
+}
+
+INIReloader::INIReloader(const string& filename, size_t max_readers)
+    : _filename(filename), _max_readers(max_readers),
+      _slots(new Slot[max_readers]), _current(new INIReader(filename)),
+      _epoch(1)
+{
+}
+
+INIReloader::~INIReloader()
+{
+    for (const Retired& r : _retired)
+        delete r.reader;
+    delete _current.load();
+}
+
+int INIReloader::Reload()
+{
+    // Parse outside the lock so a slow file doesn't hold up registering
+    // readers
+    INIReader* next = new INIReader(_filename);
+    int error = next->ParseError();
+    if (error) {
+        delete next;
+        return error;
+    }
+
+    std::lock_guard<std::mutex> guard(_lock);
+    const INIReader* old = _current.exchange(next);
+    uint64_t epoch = _epoch.fetch_add(1) + 1;
+    _retired.push_back(Retired{epoch, old});
+
+    // Every reader that loaded a retired snapshot entered before the epoch
+    // it was retired in. Free those older than the oldest reader, and leave
+    // the rest to a later Reload() rather than wait for it
+    uint64_t oldest = epoch;
+    for (size_t i = 0; i < _max_readers; i++) {
+        uint64_t e = _slots[i].epoch.load();
+        if (e != 0 && e < oldest)
+            oldest = e;
+    }
+    size_t kept = 0;
+    for (const Retired& r : _retired) {
+        if (r.epoch <= oldest)
+            delete r.reader;
+        else
+            _retired[kept++] = r;
+    }
+    _retired.resize(kept);
+    return 0;
+}
+
+uint64_t INIReloader::Generation() const
+{
+    return _epoch.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,120 @@
+// Share an INIReader between threads and reload it without stopping them.
+
+// SPDX-License-Identifier: BSD-3-Clause
+
+// inih and INIReader are released under the New BSD license (see LICENSE.txt).
+// Go to the project home page for more info:
+//
+// https://github.com/benhoyt/inih
+
+#ifndef __INIRELOADER_H__
+#define __INIRELOADER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "INIReader.h"
+
+// Snapshots of an INI file that reader threads look values up in while
+// Reload() parses the file again and publishes the new snapshot with an
+// atomic pointer swap. Old snapshots are retired and freed by a later
+// Reload() once no reader can still be using them, tracked with epochs: each
+// reader thread has its own slot on its own cache line, where it announces
+// the epoch it entered in. Looking a value up takes no lock and writes
+// nothing shared between threads, and reloading never waits for readers.
+class INIReloader
+{
+public:
+    class Reader;
+
+    // A pinned snapshot. The INIReader it points to stays alive until the
+    // Snapshot is destroyed; keep it only as long as a lookup needs it, as
+    // snapshots retired meanwhile can't be freed until then.
+    class Snapshot
+    {
+    public:
+        Snapshot(Snapshot&& other) noexcept;
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        ~Snapshot();
+
+        const INIReader& operator*() const { return *_reader; }
+        const INIReader* operator->() const { return _reader; }
+
+    private:
+        friend class Reader;
+        Snapshot(std::atomic<uint64_t>* slot, const INIReader* reader);
+
+        std::atomic<uint64_t>* _slot;
+        const INIReader* _reader;
+    };
+
+    // Registration of one reader thread. A Reader is used by one thread at a
+    // time and pins at most one Snapshot at a time, which must be destroyed
+    // before the Reader is and before it calls Read() again.
+    class Reader
+    {
+    public:
+        // Claim a free slot, or throw std::length_error if max_readers are
+        // already registered. Registering takes a lock; reading doesn't.
+        explicit Reader(INIReloader& reloader);
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+        ~Reader();
+
+        // Pin and return the current snapshot.
+        Snapshot Read();
+
+    private:
+        INIReloader& _reloader;
+        size_t _slot;
+    };
+
+    // Parse filename into the first snapshot. Up to max_readers Readers can
+    // be registered at once.
+    explicit INIReloader(const std::string& filename, size_t max_readers = 64);
+    INIReloader(const INIReloader&) = delete;
+    INIReloader& operator=(const INIReloader&) = delete;
+    ~INIReloader();
+
+    // Parse the file again and publish the new snapshot, retiring the old
+    // one, then free the retired snapshots no reader is still using. If the
+    // file can't be opened or has an error, the current snapshot is kept.
+    // Return the result of parsing, as INIReader::ParseError() does. Calls
+    // from several threads are serialized, and may be made while holding a
+    // Snapshot.
+    int Reload();
+
+    // Return the number of snapshots published, counting the first.
+    uint64_t Generation() const;
+
+private:
+    // Epoch a reader entered in, 0 when it holds no snapshot. Padded so that
+    // readers never write to a cache line another thread uses.
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0};
+        bool used = false;
+    };
+
+    // A snapshot replaced in epoch, which readers that entered before it
+    // may still be using
+    struct Retired {
+        uint64_t epoch;
+        const INIReader* reader;
+    };
+
+    std::string _filename;
+    size_t _max_readers;
+    std::unique_ptr<Slot[]> _slots;
+    std::mutex _lock; // serializes Reload() and registration
+    std::vector<Retired> _retired; // guarded by _lock
+
+    // Read by every reader, written only by Reload()
+    alignas(64) std::atomic<const INIReader*> _current;
+    std::atomic<uint64_t> _epoch;
+};
+
+#endif  // __INIRELOADER_H__
@@ -0,0 +1,347 @@
+// Fill a plain struct from an INI file according to a compile-time schema.
+
+// SPDX-License-Identifier: BSD-3-Clause
+
+// inih and INIReader are released under the New BSD license (see LICENSE.txt).
+// Go to the project home page for more info:
+//
+// https://github.com/benhoyt/inih
+
+#ifndef __INISCHEMA_H__
+#define __INISCHEMA_H__
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "../ini.h"
+
+// One field of a schema: the value of name in section, converted to the type
+// of a member of T. Build fields with INIField<&T::member>(section, name,
+// default_value). Values are converted as INIReader's typed getters convert
+// them, and a value that doesn't convert leaves the default.
+template <class T>
+struct INIFieldOf {
+    // Default value of the member, of the alternative its type uses
+    union Default {
+        long integer;
+        double real;
+        bool boolean;
+        const char* string;
+
+        constexpr Default(long i) : integer(i) {}
+        constexpr Default(double r) : real(r) {}
+        constexpr Default(bool b) : boolean(b) {}
+        constexpr Default(const char* s) : string(s) {}
+    };
+
+    std::string_view section;
+    std::string_view name;
+    Default default_value;
+    void (*reset)(T& out, const Default& default_value);
+    void (*assign)(T& out, const char* value);
+};
+
+namespace ini_schema {
+
+// Fold an ASCII letter to lower case to make section/name lookups
+// case-insensitive
+constexpr unsigned char Fold(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+constexpr bool FoldEqual(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (Fold(a[i]) != Fold(b[i]))
+            return false;
+    }
+    return true;
+}
+
+constexpr bool FoldEqual(std::string_view a, const char* b)
+{
+    size_t i = 0;
+    for (; i < a.size(); i++) {
+        if (!b[i] || Fold(a[i]) != Fold(b[i]))
+            return false;
+    }
+    return !b[i];
+}
+
+// 32-bit FNV-1a of the case-folded section and name
+template <class Str>
+constexpr uint32_t Hash(Str section, Str name)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; section[i]; i++)
+        hash = (hash ^ Fold(section[i])) * 16777619u;
+    hash = (hash ^ '=') * 16777619u;
+    for (size_t i = 0; name[i]; i++)
+        hash = (hash ^ Fold(name[i])) * 16777619u;
+    return hash;
+}
+
+// Rehash a name's hash with its bucket's displacement
+constexpr uint32_t Mix(uint32_t hash, uint32_t displacement)
+{
+    hash = (hash ^ displacement) * 0x9E3779B1u;
+    return hash ^ (hash >> 16);
+}
+
+// Null-terminated view of a string_view known to end at a literal's null
+struct Chars {
+    std::string_view str;
+    constexpr char operator[](size_t i) const { return i < str.size() ? str[i] : 0; }
+};
+
+inline bool Convert(const char* value, long& out)
+{
+    char* end;
+    // This parses "1234" (decimal) and also "0x4D2" (hex)
+    long n = strtol(value, &end, 0);
+    if (end > value)
+        out = n;
+    return end > value;
+}
+
+inline bool Convert(const char* value, int& out)
+{
+    long n;
+    if (!Convert(value, n))
+        return false;
+    out = (int)n;
+    return true;
+}
+
+inline bool Convert(const char* value, double& out)
+{
+    char* end;
+    double n = strtod(value, &end);
+    if (end > value)
+        out = n;
+    return end > value;
+}
+
+inline bool Convert(const char* value, bool& out)
+{
+    std::string_view v(value);
+    if (FoldEqual(v, "true") || FoldEqual(v, "yes") || FoldEqual(v, "on") || v == "1")
+        out = true;
+    else if (FoldEqual(v, "false") || FoldEqual(v, "no") || FoldEqual(v, "off") || v == "0")
+        out = false;
+    else
+        return false;
+    return true;
+}
+
+inline bool Convert(const char* value, std::string& out)
+{
+    out = value;
+    return true;
+}
+
+template <class M>
+struct MemberOf;
+
+template <class T, class V>
+struct MemberOf<V T::*> {
+    using Class = T;
+    using Type = V;
+};
+
+template <auto Member>
+void Reset(typename MemberOf<decltype(Member)>::Class& out,
+           const typename INIFieldOf<typename MemberOf<decltype(Member)>::Class>::Default& d)
+{
+    using V = typename MemberOf<decltype(Member)>::Type;
+    if constexpr (std::is_same_v<V, bool>)
+        out.*Member = d.boolean;
+    else if constexpr (std::is_same_v<V, double>)
+        out.*Member = d.real;
+    else if constexpr (std::is_same_v<V, std::string>)
+        out.*Member = d.string;
+    else
+        out.*Member = (V)d.integer;
+}
+
+template <auto Member>
+void Assign(typename MemberOf<decltype(Member)>::Class& out, const char* value)
+{
+    Convert(value, out.*Member);
+}
+
+}  // namespace ini_schema
+
+// Build the field of a schema that stores the value of name in section in
+// Member, a pointer to a long, int, double, bool or std::string member.
+template <auto Member, class D>
+constexpr INIFieldOf<typename ini_schema::MemberOf<decltype(Member)>::Class>
+INIField(std::string_view section, std::string_view name, D default_value)
+{
+    using T = typename ini_schema::MemberOf<decltype(Member)>::Class;
+    using V = typename ini_schema::MemberOf<decltype(Member)>::Type;
+    using Default = typename INIFieldOf<T>::Default;
+
+    if constexpr (std::is_same_v<V, bool>)
+        return {section, name, Default((bool)default_value),
+                ini_schema::Reset<Member>, ini_schema::Assign<Member>};
+    else if constexpr (std::is_same_v<V, double>)
+        return {section, name, Default((double)default_value),
+                ini_schema::Reset<Member>, ini_schema::Assign<Member>};
+    else if constexpr (std::is_same_v<V, std::string>)
+        return {section, name, Default((const char*)default_value),
+                ini_schema::Reset<Member>, ini_schema::Assign<Member>};
+    else
+        return {section, name, Default((long)default_value),
+                ini_schema::Reset<Member>, ini_schema::Assign<Member>};
+}
+
+// Schema of N fields of T. The constructor searches for a perfect hash of the
+// fields' section and name, so a schema declared constexpr has its table
+// built at compile time (and fails to compile on duplicate fields). Parsing
+// fills T straight from the parser's callbacks: each pair costs one hash and
+// one compare, and pairs not in the schema are skipped without allocating.
+// Section and name lookups are case-insensitive. If a name appears more than
+// once the last value wins.
+template <class T, size_t N>
+class INISchema
+{
+public:
+    template <class... F>
+    constexpr INISchema(const F&... fields)
+        : _fields{fields...}, _displacements{}, _slots{}
+    {
+        for (size_t i = 0; i < N; i++) {
+            for (size_t j = 0; j < i; j++) {
+                if (ini_schema::FoldEqual(_fields[i].section, _fields[j].section) &&
+                    ini_schema::FoldEqual(_fields[i].name, _fields[j].name))
+                    throw "duplicate field in schema";
+            }
+        }
+        // Hash and displace: spread the fields over buckets, then, largest
+        // bucket first, find a displacement that moves all of a bucket's
+        // fields to free slots
+        uint32_t hashes[N] = {};
+        size_t sizes[BUCKETS] = {};
+        size_t largest = 0;
+        for (size_t i = 0; i < N; i++) {
+            hashes[i] = ini_schema::Hash(ini_schema::Chars{_fields[i].section},
+                                         ini_schema::Chars{_fields[i].name});
+            size_t size = ++sizes[hashes[i] & (BUCKETS - 1)];
+            if (size > largest)
+                largest = size;
+        }
+        for (size_t size = largest; size > 0; size--) {
+            for (size_t b = 0; b < BUCKETS; b++) {
+                if (sizes[b] == size)
+                    Displace(b, hashes);
+            }
+        }
+    }
+
+    // Set every field of out to its default.
+    void Reset(T& out) const
+    {
+        for (const INIFieldOf<T>& f : _fields)
+            f.reset(out, f.default_value);
+    }
+
+    // Reset out and fill it from the given INI file. Return the result of
+    // ini_parse(): 0 on success, line number of first error on parse error,
+    // or -1 on file open error.
+    int Parse(const std::string& filename, T& out,
+              ini_parser_config config = ini_parser_config{}) const
+    {
+        Context ctx = {this, &out};
+        Reset(out);
+        return ini_parse(filename.c_str(), Handler, config, &ctx);
+    }
+
+    // Same as Parse(), but reads INI data from a buffer.
+    int ParseBuffer(std::string_view buffer, T& out,
+                    ini_parser_config config = ini_parser_config{}) const
+    {
+        Context ctx = {this, &out};
+        Reset(out);
+        return ini_parse_buffer(buffer.data(), buffer.size(), Handler, config,
+                                &ctx);
+    }
+
+private:
+    // Buckets are at least the fields and slots twice that, powers of two
+    static constexpr size_t BUCKETS = [] {
+        size_t n = 1;
+        while (n < N)
+            n *= 2;
+        return n;
+    }();
+    static constexpr size_t SLOTS = 2 * BUCKETS;
+
+    struct Context {
+        const INISchema* schema;
+        T* out;
+    };
+
+    std::array<INIFieldOf<T>, N> _fields;
+    std::array<uint32_t, BUCKETS> _displacements;
+    std::array<uint16_t, SLOTS> _slots; // index + 1 of a field, 0 if empty
+
+    constexpr size_t Slot(uint32_t hash) const
+    {
+        uint32_t displacement = _displacements[hash & (BUCKETS - 1)];
+        return ini_schema::Mix(hash, displacement) & (SLOTS - 1);
+    }
+
+    // Find the displacement of bucket b that puts its fields in free slots
+    constexpr void Displace(size_t b, const uint32_t* hashes)
+    {
+        for (uint32_t d = 0; d < 1000000; d++) {
+            _displacements[b] = d;
+            size_t i = 0;
+            for (; i < N; i++) {
+                if ((hashes[i] & (BUCKETS - 1)) != b)
+                    continue;
+                size_t slot = Slot(hashes[i]);
+                if (_slots[slot])
+                    break;
+                _slots[slot] = (uint16_t)(i + 1);
+            }
+            if (i == N)
+                return;
+            // Undo this try's claims
+            for (size_t j = 0; j < i; j++) {
+                if ((hashes[j] & (BUCKETS - 1)) == b)
+                    _slots[Slot(hashes[j])] = 0;
+            }
+        }
+        throw "no perfect hash for schema";
+    }
+
+    static int Handler(void* user, const char* section, const char* name,
+                       const char* value)
+    {
+        const Context* ctx = static_cast<const Context*>(user);
+        const INISchema* schema = ctx->schema;
+        if (!name || !value)
+            return 1;
+        uint16_t i = schema->_slots[schema->Slot(ini_schema::Hash(section, name))];
+        if (!i)
+            return 1;
+        const INIFieldOf<T>& f = schema->_fields[i - 1];
+        if (ini_schema::FoldEqual(f.section, section) &&
+            ini_schema::FoldEqual(f.name, name))
+            f.assign(*ctx->out, value);
+        return 1;
+    }
+};
+
+template <class T, class... F>
+INISchema(const INIFieldOf<T>&, const F&...) -> INISchema<T, 1 + sizeof...(F)>;
+
+#endif  // __INISCHEMA_H__
@@ -1,7 +1,28 @@
 // Example that shows simple usage of the INIReader class
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <iostream>
+#include <string_view>
+#include "../cpp/INICache.h"
 #include "../cpp/INIReader.h"
+#include "../cpp/INISchema.h"
+
+struct Config {
+    long version;
+    std::string name;
+    double pi;
+    bool active;
+    int port;
+};
+
+constexpr INISchema schema{
+    INIField<&Config::version>("protocol", "version", -1),
+    INIField<&Config::name>("user", "name", "UNKNOWN"),
+    INIField<&Config::pi>("user", "pi", -1),
+    INIField<&Config::active>("user", "active", false),
+    INIField<&Config::port>("server", "port", 8080),
+};
 
 int main()
 {
@@ -21,5 +42,53 @@ int main()
               << ", user.nose=" << reader.HasValue("user", "nose") << "\n";
     std::cout << "Has sections: user=" << reader.HasSection("user")
               << ", fizz=" << reader.HasSection("fizz") << "\n";
+    std::cout << "Any case: USER.Name=" << reader.Get("USER", "Name", "UNKNOWN")
+              << ", Protocol=" << reader.HasSection("Protocol") << "\n";
+
+    long version = -1;
+    std::string name = "UNKNOWN";
+    double pi = -1;
+    bool active = false;
+    bool missing = true;
+    size_t bound = reader.Bind({
+        {"protocol", "version", &version},
+        {"user", "name", &name},
+        {"user", "pi", &pi},
+        {"user", "active", &active},
+        {"user", "missing", &missing},
+    });
+    std::cout << "Bound " << bound << ": version=" << version << ", name="
+              << name << ", pi=" << pi << ", active=" << active
+              << ", missing=" << missing << "\n";
+
+    std::string_view blob = "[protocol]\nversion = 7\n";
+    INIReader from_buffer(blob.data(), blob.size());
+    int fd = open("../examples/test.ini", O_RDONLY);
+    INIReader from_fd(fd);
+    close(fd);
+    INIReader moved = std::move(from_fd);
+    std::cout << "Buffer: version=" << from_buffer.GetInteger("protocol", "version", -1)
+              << ", moved fd: name=" << moved.Get("user", "name", "UNKNOWN")
+              << "\n";
+
+    std::vector<std::string_view> where = reader.FindSections("Active", "true");
+    std::cout << "Where active=true: " << (where.empty() ? "none" : where[0])
+              << ", version=7: " << reader.FindSections("version", "7").size()
+              << "\n";
+
+    INICache cache(1 << 20);
+    cache.Get("../examples/test.ini");
+    std::cout << "Cached: name="
+              << cache.Get("../examples/test.ini")->Get("user", "name", "UNKNOWN");
+    INICache::Stats stats = cache.GetStats();
+    std::cout << ", hits=" << stats.hits << ", misses=" << stats.misses
+              << ", entries=" << stats.entries << "\n";
+
+    Config config;
+    int error = schema.Parse("../examples/test.ini", config);
+    std::cout << "Schema " << error << ": version=" << config.version
+              << ", name=" << config.name << ", pi=" << config.pi
+              << ", active=" << config.active << ", port=" << config.port
+              << "\n";
     return 0;
 }
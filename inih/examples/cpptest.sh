@@ -1,5 +1,5 @@
 #!/usr/bin/env bash
 
-g++ INIReaderExample.cpp ../cpp/INIReader.cpp ../ini.c -o INIReaderExample
+g++ INIReaderExample.cpp ../cpp/INICache.cpp ../cpp/INIReader.cpp ../ini.c -o INIReaderExample
 ./INIReaderExample > cpptest.txt
 rm INIReaderExample
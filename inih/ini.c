@@ -17,16 +17,31 @@ https://github.com/benhoyt/inih
 
 #include <stdio.h>
 #include <ctype.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "ini.h"
 
-#if !INI_USE_STACK
-#include <stdlib.h>
+#define MAX_SECTION INI_MAX_SECTION
+
+/* Longest line ini_parse_stream() reads in one go. Longer lines are split into
+   several lines, and lines read from a buffer must be split the same way. */
+#if INI_USE_STACK || INI_ALLOW_REALLOC
+#define SCAN_MAX_LINE INI_MAX_LINE
+#else
+#define SCAN_MAX_LINE INI_INITIAL_ALLOC
 #endif
 
-#define MAX_SECTION 50
-#define MAX_NAME 50
+/* Growable buffer holding the name and value of a multi-line pair until its
+   last line is read. The name starts the buffer, the value follows it. */
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t size;
+    size_t value_off;
+    int lineno;
+    int pending;
+} ini_value;
 
 /* Used by ini_parse_string() to keep track of string parsing state. */
 typedef struct {
@@ -34,196 +49,536 @@ typedef struct {
     size_t num_left;
 } ini_parse_string_ctx;
 
-/* Strip whitespace chars off end of given string, in place. Return s. */
-static char* rstrip(char* s)
+/* Return pointer to first char (of chars) or inline comment in [s, end), or
+   end if neither found. Inline comment must be prefixed by a whitespace
+   character to register as a comment. */
+static const char* find_chars_or_comment_n(const char* s, const char* end,
+                                           const char* chars)
 {
-    char* p = s + strlen(s);
-    while (p > s && isspace((unsigned char)(*--p)))
-        *p = '\0';
+#if INI_ALLOW_INLINE_COMMENTS
+    int was_space = 0;
+    while (s < end && !strchr(chars, *s) &&
+           !(was_space && strchr(INI_INLINE_COMMENT_PREFIXES, *s))) {
+        was_space = isspace((unsigned char)(*s));
+        s++;
+    }
+#else
+    while (s < end && !strchr(chars, *s)) {
+        s++;
+    }
+#endif
     return s;
 }
 
-/* Return pointer to first non-whitespace char in given string. */
-static char* lskip(const char* s)
+/* Force inlining where supported, so each parser variant below is compiled
+   with its options as constants. */
+#if defined(__GNUC__)
+#define INI_INLINE inline __attribute__((always_inline))
+#else
+#define INI_INLINE inline
+#endif
+
+/* Kinds of key/value separator sets the parser is specialized for. */
+enum {
+    SEPS_DEFAULT, /* "=:" */
+    SEPS_ONE,     /* a single separator */
+    SEPS_ANY
+};
+
+/* Return nonzero if ch is one of the separators in seps, of the given kind. */
+static INI_INLINE int is_sep(char ch, const char* seps, int kind)
 {
-    while (*s && isspace((unsigned char)(*s)))
-        s++;
-    return (char*)s;
+    switch (kind) {
+    case SEPS_DEFAULT:
+        return ch == '=' || ch == ':';
+    case SEPS_ONE:
+        return ch == *seps;
+    default:
+        return strchr(seps, ch) != NULL;
+    }
 }
 
-/* Return pointer to first char (of chars) or inline comment in given string,
-   or pointer to null at end of string if neither found. Inline comment must
-   be prefixed by a whitespace character to register as a comment. */
-static char* find_chars_or_comment(const char* s, const char* chars)
+/* Same as find_chars_or_comment_n(), for a set of separators of the given
+   kind. */
+static INI_INLINE const char* find_seps_or_comment(const char* s,
+                                                   const char* end,
+                                                   const char* seps, int kind)
 {
 #if INI_ALLOW_INLINE_COMMENTS
     int was_space = 0;
-    while (*s && (!chars || !strchr(chars, *s)) &&
+    while (s < end && !is_sep(*s, seps, kind) &&
            !(was_space && strchr(INI_INLINE_COMMENT_PREFIXES, *s))) {
         was_space = isspace((unsigned char)(*s));
         s++;
     }
 #else
-    while (*s && (!chars || !strchr(chars, *s))) {
+    while (s < end && !is_sep(*s, seps, kind)) {
         s++;
     }
 #endif
-    return (char*)s;
+    return s;
+}
+
+/* Append join (unless zero) and len bytes of str to value, doubling its buffer
+   as needed so that a value of n bytes costs O(n). Return 0 on allocation
+   failure. */
+static int value_append(ini_value* value, char join, const char* str,
+                        size_t len)
+{
+    size_t need = value->len + (join ? 1 : 0) + len + 1;
+    char* buf;
+
+    if (need > value->size) {
+        size_t size = value->size ? value->size : INI_INITIAL_ALLOC;
+        while (size < need)
+            size *= 2;
+        buf = (char*)realloc(value->buf, size);
+        if (!buf)
+            return 0;
+        value->buf = buf;
+        value->size = size;
+    }
+
+    if (join)
+        value->buf[value->len++] = join;
+    memcpy(value->buf + value->len, str, len);
+    value->len += len;
+    value->buf[value->len] = '\0';
+    return 1;
 }
 
-/* Version of strncpy that ensures dest (size bytes) is null-terminated. */
-static char* strncpy0(char* dest, const char* src, size_t size)
+/* Split the next line off a buffer exactly where the fgets() reader would,
+   advancing *ptr past it. The line is [*line, *end), which stops at a null
+   byte as the parser sees lines as strings. */
+static void buffer_line(const char** ptr, const char* buf_end,
+                        const char** line, const char** end)
 {
-    strncpy(dest, src, size - 1);
-    dest[size - 1] = '\0';
-    return dest;
+    size_t n = (size_t)(buf_end - *ptr);
+    const char* nl;
+
+    if (n > SCAN_MAX_LINE - 1)
+        n = SCAN_MAX_LINE - 1;
+    nl = (const char*)memchr(*ptr, '\n', n);
+    *line = *ptr;
+    *ptr = nl ? nl + 1 : *ptr + n;
+
+    *end = (const char*)memchr(*line, '\0', (size_t)(*ptr - *line));
+    if (!*end)
+        *end = *ptr;
 }
 
-/* See documentation in header file. */
-int ini_parse_stream(ini_reader reader, void* stream, ini_handler handler,
-                     ini_parser_config c, void* user)
+/* Read the next line into [*line, *end). Return 1, 0 at the end of input or
+   -2 on memory allocation error. */
+static int next_line(ini_reader_state* st, const char** line,
+                     const char** end)
 {
-    /* Uses a fair bit of stack (use heap instead if you need to) */
-#if INI_USE_STACK
-    char line[INI_MAX_LINE];
-    int max_line = INI_MAX_LINE;
-#else
-    char* line;
-    size_t max_line = INI_INITIAL_ALLOC;
-#endif
 #if INI_ALLOW_REALLOC && !INI_USE_STACK
     char* new_line;
     size_t offset;
 #endif
-    char section[MAX_SECTION] = "";
-    char prev_name[MAX_NAME] = "";
 
-    char* start;
-    char* end;
-    char* name;
-    char* value;
-    int lineno = 0;
-    int error = 0;
-
-#if !INI_USE_STACK
-    line = (char*)malloc(INI_INITIAL_ALLOC);
-    if (!line) {
-        return -2;
+    if (!st->reader) {
+        if (st->ptr >= st->end)
+            return 0;
+        buffer_line(&st->ptr, st->end, line, end);
+        return 1;
     }
-#endif
-
-#if INI_HANDLER_LINENO
-#define HANDLER(u, s, n, v) handler(u, s, n, v, lineno)
-#else
-#define HANDLER(u, s, n, v) handler(u, s, n, v)
-#endif
 
-    if (!c.seps)
-        c.seps = "=:";
+    if (st->reader(st->line, (int)st->max_line, st->stream) == NULL)
+        return 0;
 
-    /* Scan through stream line by line */
-    while (reader(line, (int)max_line, stream) != NULL) {
 #if INI_ALLOW_REALLOC && !INI_USE_STACK
-        offset = strlen(line);
-        while (offset == max_line - 1 && line[offset - 1] != '\n') {
-            max_line *= 2;
-            if (max_line > INI_MAX_LINE)
-                max_line = INI_MAX_LINE;
-            new_line = realloc(line, max_line);
-            if (!new_line) {
-                free(line);
-                return -2;
-            }
-            line = new_line;
-            if (reader(line + offset, (int)(max_line - offset), stream) == NULL)
-                break;
-            if (max_line >= INI_MAX_LINE)
-                break;
-            offset += strlen(line + offset);
-        }
+    offset = strlen(st->line);
+    while (offset == st->max_line - 1 && st->line[offset - 1] != '\n') {
+        st->max_line *= 2;
+        if (st->max_line > INI_MAX_LINE)
+            st->max_line = INI_MAX_LINE;
+        new_line = realloc(st->line, st->max_line);
+        if (!new_line)
+            return -2;
+        st->line = new_line;
+        if (st->reader(st->line + offset, (int)(st->max_line - offset),
+                       st->stream) == NULL)
+            break;
+        if (st->max_line >= INI_MAX_LINE)
+            break;
+        offset += strlen(st->line + offset);
+    }
 #endif
 
-        lineno++;
+    *line = st->line;
+    *end = st->line + strlen(st->line);
+    return 1;
+}
+
+/* Point slice at [start, end). Lines read from a stream are in the state's
+   own buffer, so their slices are null-terminated as well. */
+static INI_INLINE void set_slice(const ini_reader_state* st, ini_slice* slice,
+                                 const char* start, const char* end)
+{
+    slice->ptr = start;
+    slice->len = (size_t)(end - start);
+    if (st->reader)
+        *(char*)end = '\0';
+}
+
+/* Body of ini_reader_next(), inlined into one variant for each combination
+   of multi and seps_kind. */
+static INI_INLINE int reader_next(ini_reader_state* st, ini_event* event,
+                                  const int multi, const int seps_kind)
+{
+    const char* line;
+    const char* start;
+    const char* end;
+    const char* p;
+    const char* value;
+    size_t n;
+    int ret;
+
+    /* Scan line by line until one makes an event */
+    while ((ret = next_line(st, &line, &end)) > 0) {
+        st->lineno++;
 
         start = line;
 #if INI_ALLOW_BOM
-        if (lineno == 1 && (unsigned char)start[0] == 0xEF &&
-                           (unsigned char)start[1] == 0xBB &&
-                           (unsigned char)start[2] == 0xBF) {
+        if (st->lineno == 1 && end - start >= 3 &&
+                               (unsigned char)start[0] == 0xEF &&
+                               (unsigned char)start[1] == 0xBB &&
+                               (unsigned char)start[2] == 0xBF) {
             start += 3;
         }
 #endif
-        start = lskip(rstrip(start));
-
-        if (strchr(INI_START_COMMENT_PREFIXES, *start)) {
-            /* Start-of-line comment */
-        }
-        else if (c.multi && *prev_name && *start && start > line) {
+        while (end > start && isspace((unsigned char)end[-1]))
+            end--;
+        while (start < end && isspace((unsigned char)(*start)))
+            start++;
+
+        if (start == end || strchr(INI_START_COMMENT_PREFIXES, *start))
+            continue; /* Blank line or start-of-line comment */
+
+        event->lineno = st->lineno;
+        event->section = st->section;
+        event->name.ptr = NULL;
+        event->name.len = 0;
+        event->value.ptr = NULL;
+        event->value.len = 0;
+
+        if (multi && st->has_prev_name && start > line) {
             /* Non-blank line with leading whitespace, treat as continuation
                of previous name's value (as per Python configparser). */
-            if (!HANDLER(user, section, prev_name, start) && !error)
-                error = lineno;
+            event->type = INI_EVENT_CONTINUATION;
+            set_slice(st, &event->value, start, end);
         }
         else if (*start == '[') {
             /* A "[section]" line */
-            end = find_chars_or_comment(start + 1, "]");
-            if (*end == ']') {
-                *end = '\0';
-                strncpy0(section, start + 1, sizeof(section));
-                *prev_name = '\0';
-#if INI_CALL_HANDLER_ON_NEW_SECTION
-                if (!HANDLER(user, section, NULL, NULL) && !error)
-                    error = lineno;
-#endif
+            p = find_chars_or_comment_n(start + 1, end, "]");
+            if (p < end && *p == ']') {
+                n = (size_t)(p - start - 1);
+                if (n > sizeof(st->section) - 1)
+                    n = sizeof(st->section) - 1;
+                memcpy(st->section, start + 1, n);
+                st->section[n] = '\0';
+                st->has_prev_name = 0;
+                event->type = INI_EVENT_SECTION;
             }
-            else if (!error) {
+            else {
                 /* No ']' found on section line */
-                error = lineno;
+                event->type = INI_EVENT_ERROR;
             }
         }
-        else if (*start) {
+        else {
             /* Not a comment, must be a name[seps]value pair */
-            end = find_chars_or_comment(start, c.seps);
-            if (*end) {
-                *end = '\0';
-                name = rstrip(start);
-                value = end + 1;
+            p = find_seps_or_comment(start, end, st->c.seps, seps_kind);
+            if (p < end) {
+                value = p + 1;
 #if INI_ALLOW_INLINE_COMMENTS
-                end = find_chars_or_comment(value, NULL);
-                if (*end)
-                    *end = '\0';
+                end = find_chars_or_comment_n(value, end, "");
 #endif
-                value = lskip(value);
-                rstrip(value);
-
-                /* Valid name[seps]value pair found, call handler */
-                strncpy0(prev_name, name, sizeof(prev_name));
-                if (!HANDLER(user, section, name, value) && !error)
-                    error = lineno;
+                while (value < end && isspace((unsigned char)(*value)))
+                    value++;
+                while (end > value && isspace((unsigned char)end[-1]))
+                    end--;
+                set_slice(st, &event->value, value, end);
+
+                while (p > start && isspace((unsigned char)p[-1]))
+                    p--;
+                set_slice(st, &event->name, start, p);
+                st->has_prev_name = p > start;
+                event->type = INI_EVENT_PAIR;
             }
-            else if (!error) {
+            else {
                 /* No '=' or ':' found on name[=:]value line */
 #if INI_ALLOW_NO_VALUE
-                *end = '\0';
-                name = rstrip(start);
-                if (!HANDLER(user, section, name, NULL) && !error)
-                    error = lineno;
+                set_slice(st, &event->name, start, end);
+                event->type = INI_EVENT_PAIR;
 #else
-                error = lineno;
+                event->type = INI_EVENT_ERROR;
 #endif
             }
         }
 
+        return 1;
+    }
+
+    return ret;
+}
+
+#if INI_SPECIALIZE_PARSERS
+#define NEXT_VARIANT(name, multi, seps_kind)                            \
+    static int name(ini_reader_state* st, ini_event* event)             \
+    {                                                                   \
+        return reader_next(st, event, multi, seps_kind);                \
+    }
+
+NEXT_VARIANT(next_default, 0, SEPS_DEFAULT)
+NEXT_VARIANT(next_one, 0, SEPS_ONE)
+NEXT_VARIANT(next_any, 0, SEPS_ANY)
+NEXT_VARIANT(next_multi_default, 1, SEPS_DEFAULT)
+NEXT_VARIANT(next_multi_one, 1, SEPS_ONE)
+NEXT_VARIANT(next_multi_any, 1, SEPS_ANY)
+
+static int (*const next_variants[2][3])(ini_reader_state*, ini_event*) = {
+    {next_default, next_one, next_any},
+    {next_multi_default, next_multi_one, next_multi_any},
+};
+
+/* Return the kind of separator set in seps. */
+static int seps_kind(const char* seps)
+{
+    if (strcmp(seps, "=:") == 0 || strcmp(seps, ":=") == 0)
+        return SEPS_DEFAULT;
+    if (seps[0] && !seps[1])
+        return SEPS_ONE;
+    return SEPS_ANY;
+}
+#else
+/* A single variant that tests the options on every line */
+static int next_generic(ini_reader_state* st, ini_event* event)
+{
+    return reader_next(st, event, st->c.multi, SEPS_ANY);
+}
+#endif
+
+/* Fill in the fields common to both kinds of reader state. */
+static void reader_init(ini_reader_state* st, ini_parser_config c)
+{
+    if (!c.seps)
+        c.seps = "=:";
+    if (!c.join)
+        c.join = '\n';
+
+#if INI_SPECIALIZE_PARSERS
+    /* Pick the variant once instead of testing the options on every line */
+    st->next = next_variants[c.multi != 0][seps_kind(c.seps)];
+#else
+    st->next = next_generic;
+#endif
+
+    st->c = c;
+    st->lineno = 0;
+    st->has_prev_name = 0;
+    st->section[0] = '\0';
+}
+
+/* See documentation in header file. */
+void ini_reader_init_buffer(ini_reader_state* state, const char* buf,
+                            size_t len, ini_parser_config c)
+{
+    reader_init(state, c);
+    state->ptr = buf;
+    state->end = buf + len;
+    state->reader = NULL;
+    state->stream = NULL;
+#if !INI_USE_STACK
+    state->line = NULL;
+#endif
+}
+
+/* See documentation in header file. */
+int ini_reader_init_stream(ini_reader_state* state, ini_reader reader,
+                           void* stream, ini_parser_config c)
+{
+    reader_init(state, c);
+    state->ptr = NULL;
+    state->end = NULL;
+    state->reader = reader;
+    state->stream = stream;
+#if INI_USE_STACK
+    state->max_line = INI_MAX_LINE;
+#else
+    state->max_line = INI_INITIAL_ALLOC;
+    state->line = (char*)malloc(INI_INITIAL_ALLOC);
+    if (!state->line)
+        return -2;
+#endif
+    return 0;
+}
+
+/* See documentation in header file. */
+int ini_reader_next(ini_reader_state* state, ini_event* event)
+{
+    return state->next(state, event);
+}
+
+/* See documentation in header file. */
+void ini_reader_free(ini_reader_state* state)
+{
+#if !INI_USE_STACK
+    free(state->line);
+    state->line = NULL;
+#else
+    (void)state;
+#endif
+}
+
+/* Body of ini_parse_stream(), inlined into one variant for each combination
+   of multi and seps_kind. Calls handler for the events read from st. */
+static INI_INLINE int parse_stream(ini_reader_state* st, ini_handler handler,
+                                   void* user, const int multi,
+                                   const int seps_kind)
+{
+    char section[MAX_SECTION] = "";
+    ini_value value_buf = {NULL, 0, 0, 0, 0, 0};
+    ini_event event;
+    int error = 0;
+    int ret;
+
+#if INI_HANDLER_LINENO
+#define HANDLER_AT(u, s, n, v, l) handler(u, s, n, v, l)
+#else
+#define HANDLER_AT(u, s, n, v, l) handler(u, s, n, v)
+#endif
+#define HANDLER(u, s, n, v) HANDLER_AT(u, s, n, v, event.lineno)
+
+/* Call handler with the multi-line value being built, if any */
+#define FLUSH_VALUE()                                                   \
+    do {                                                                \
+        if (value_buf.pending) {                                        \
+            value_buf.pending = 0;                                      \
+            if (!HANDLER_AT(user, section, value_buf.buf,               \
+                            value_buf.buf + value_buf.value_off,        \
+                            value_buf.lineno) && !error)                \
+                error = value_buf.lineno;                               \
+        }                                                               \
+    } while (0)
+
+    while ((ret = reader_next(st, &event, multi, seps_kind)) > 0) {
+        switch (event.type) {
+        case INI_EVENT_CONTINUATION:
+            if (!value_append(&value_buf, st->c.join, event.value.ptr,
+                              event.value.len))
+                error = -2;
+            break;
+
+        case INI_EVENT_SECTION:
+            FLUSH_VALUE();
+            strcpy(section, event.section);
+#if INI_CALL_HANDLER_ON_NEW_SECTION
+            if (!HANDLER(user, section, NULL, NULL) && !error)
+                error = event.lineno;
+#endif
+            break;
+
+        case INI_EVENT_PAIR:
+            if (!event.value.ptr) {
+                /* A name without a value */
+                if (!error) {
+                    FLUSH_VALUE();
+                    if (!HANDLER(user, section, event.name.ptr, NULL) &&
+                        !error)
+                        error = event.lineno;
+                }
+            }
+            else if (multi) {
+                /* Call handler once the value's last line is read */
+                FLUSH_VALUE();
+                value_buf.len = 0;
+                value_buf.lineno = event.lineno;
+                value_buf.pending = 1;
+                if (!value_append(&value_buf, 0, event.name.ptr,
+                                  event.name.len))
+                    error = -2;
+                else {
+                    value_buf.value_off = ++value_buf.len;
+                    if (!value_append(&value_buf, 0, event.value.ptr,
+                                      event.value.len))
+                        error = -2;
+                }
+            }
+            else {
+                FLUSH_VALUE();
+                if (!HANDLER(user, section, event.name.ptr, event.value.ptr)
+                    && !error)
+                    error = event.lineno;
+            }
+            break;
+
+        case INI_EVENT_ERROR:
+            if (!error)
+                error = event.lineno;
+            break;
+        }
+
+        if (error == -2)
+            break;
 #if INI_STOP_ON_FIRST_ERROR
         if (error)
             break;
 #endif
     }
 
-#if !INI_USE_STACK
-    free(line);
+    if (ret < 0)
+        error = ret;
+    if (error != -2)
+        FLUSH_VALUE();
+    free(value_buf.buf);
+
+    return error;
+}
+
+#if INI_SPECIALIZE_PARSERS
+#define PARSE_VARIANT(name, multi, seps_kind)                           \
+    static int name(ini_reader_state* st, ini_handler handler, void* user) \
+    {                                                                   \
+        return parse_stream(st, handler, user, multi, seps_kind);       \
+    }
+
+PARSE_VARIANT(parse_default, 0, SEPS_DEFAULT)
+PARSE_VARIANT(parse_one, 0, SEPS_ONE)
+PARSE_VARIANT(parse_any, 0, SEPS_ANY)
+PARSE_VARIANT(parse_multi_default, 1, SEPS_DEFAULT)
+PARSE_VARIANT(parse_multi_one, 1, SEPS_ONE)
+PARSE_VARIANT(parse_multi_any, 1, SEPS_ANY)
 #endif
 
+/* See documentation in header file. */
+int ini_parse_stream(ini_reader reader, void* stream, ini_handler handler,
+                     ini_parser_config c, void* user)
+{
+    ini_reader_state st;
+    int error;
+
+    if (ini_reader_init_stream(&st, reader, stream, c) < 0)
+        return -2;
+
+#if INI_SPECIALIZE_PARSERS
+    {
+        /* The handler loop inlines the reader variant st.next points to */
+        static int (*const variants[2][3])(ini_reader_state*, ini_handler,
+                                           void*) = {
+            {parse_default, parse_one, parse_any},
+            {parse_multi_default, parse_multi_one, parse_multi_any},
+        };
+
+        error = variants[st.c.multi != 0][seps_kind(st.c.seps)](&st, handler,
+                                                                user);
+    }
+#else
+    /* A single variant that tests the options on every line */
+    error = parse_stream(&st, handler, user, st.c.multi, SEPS_ANY);
+#endif
+
+    ini_reader_free(&st);
     return error;
 }
 
@@ -249,6 +604,118 @@ int ini_parse(const char* filename, ini_handler handler, ini_parser_config c,
     return error;
 }
 
+/* See documentation in header file. */
+void ini_scan_init(ini_scan_state* state, ini_parser_config c)
+{
+    if (!c.seps)
+        c.seps = "=:";
+    state->c = c;
+    state->lineno = 0;
+    state->error = 0;
+    state->has_prev_name = 0;
+    state->in_section = 0;
+    state->section[0] = '\0';
+}
+
+/* See documentation in header file. */
+size_t ini_scan_chunk(ini_scan_state* state, const char* buf, size_t len,
+                      int last, ini_handler handler, void* user)
+{
+    ini_parser_config c = state->c;
+    char* section = state->section;
+    const char* ptr = buf;
+    const char* buf_end = buf + len;
+    const char* line;
+    const char* start;
+    const char* end;
+    size_t n;
+
+    while (ptr < buf_end) {
+#if INI_STOP_ON_FIRST_ERROR
+        /* The rest of the input is skipped */
+        if (state->error)
+            return len;
+#endif
+        /* A line is complete once it has a newline or is as long as
+           buffer_line() splits lines at */
+        n = (size_t)(buf_end - ptr);
+        if (!last && n < SCAN_MAX_LINE - 1 && !memchr(ptr, '\n', n))
+            break;
+
+        buffer_line(&ptr, buf_end, &line, &end);
+        state->lineno++;
+
+        start = line;
+#if INI_ALLOW_BOM
+        if (state->lineno == 1 && end - start >= 3 &&
+                                  (unsigned char)start[0] == 0xEF &&
+                                  (unsigned char)start[1] == 0xBB &&
+                                  (unsigned char)start[2] == 0xBF) {
+            start += 3;
+        }
+#endif
+        while (end > start && isspace((unsigned char)end[-1]))
+            end--;
+        while (start < end && isspace((unsigned char)(*start)))
+            start++;
+
+        if (start == end || strchr(INI_START_COMMENT_PREFIXES, *start)) {
+            /* Blank line or start-of-line comment */
+        }
+        else if (c.multi && state->has_prev_name && start > line) {
+            /* Continuation of previous name's value */
+        }
+        else if (*start == '[') {
+            const char* close = find_chars_or_comment_n(start + 1, end, "]");
+            if (close < end && *close == ']') {
+                n = (size_t)(close - start - 1);
+                if (n > MAX_SECTION - 1)
+                    n = MAX_SECTION - 1;
+                memcpy(section, start + 1, n);
+                section[n] = '\0';
+                state->has_prev_name = 0;
+                state->in_section = 1;
+                if (!HANDLER_AT(user, section, NULL, NULL, state->lineno) &&
+                    !state->error)
+                    state->error = state->lineno;
+            }
+            else if (!state->error) {
+                /* No ']' found on section line */
+                state->error = state->lineno;
+            }
+        }
+        else if (c.multi || !state->in_section) {
+            /* Only pairs that start a multi-line value or precede the first
+               section matter here, so only those are tokenized */
+            const char* sep = find_chars_or_comment_n(start, end, c.seps);
+            if (sep < end) {
+                while (sep > start && isspace((unsigned char)sep[-1]))
+                    sep--;
+                state->has_prev_name = sep > start;
+            }
+            if ((sep < end || INI_ALLOW_NO_VALUE) && !state->in_section) {
+                state->in_section = 1;
+                if (!HANDLER_AT(user, section, "", "", state->lineno) &&
+                    !state->error)
+                    state->error = state->lineno;
+            }
+        }
+    }
+
+    return (size_t)(ptr - buf);
+}
+
+/* See documentation in header file. */
+int ini_scan_sections(const char* buf, size_t len, ini_handler handler,
+                      ini_parser_config c, void* user)
+{
+    ini_scan_state state;
+
+    ini_scan_init(&state, c);
+    ini_scan_chunk(&state, buf, len, 1, handler, user);
+    return state.error;
+}
+
 /* An ini_reader function to read the next line from a string buffer. This
    is the fgets() equivalent used by ini_parse_string(). */
 static char* ini_reader_string(char* str, int num, void* stream) {
@@ -277,13 +744,20 @@ static char* ini_reader_string(char* str, int num, void* stream) {
 }
 
 /* See documentation in header file. */
-int ini_parse_string(const char* string, ini_handler handler, ini_parser_config c,
-                     void* user)
+int ini_parse_buffer(const char* buf, size_t len, ini_handler handler,
+                     ini_parser_config c, void* user)
 {
     ini_parse_string_ctx ctx;
 
-    ctx.ptr = string;
-    ctx.num_left = strlen(string);
+    ctx.ptr = buf;
+    ctx.num_left = len;
     return ini_parse_stream((ini_reader)ini_reader_string, &ctx, handler, c,
                             user);
 }
+
+/* See documentation in header file. */
+int ini_parse_string(const char* string, ini_handler handler, ini_parser_config c,
+                     void* user)
+{
+    return ini_parse_buffer(string, strlen(string), handler, c, user);
+}
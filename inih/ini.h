@@ -24,6 +24,8 @@ extern "C" {
 typedef struct {
     const char *seps;
     int multi;
+    /* Character joining the lines of a multi-line value, '\n' if zero. */
+    char join;
 } ini_parser_config;
 
 /* Nonzero if ini_handler callback should accept lineno parameter. */
@@ -77,9 +79,25 @@ already in memory. */
 int ini_parse_string(const char* string, ini_handler handler, ini_parser_config c,
                      void* user);
 
+/* Same as ini_parse_string(), but takes a buffer of len bytes that needn't be
+   zero-terminated. */
+int ini_parse_buffer(const char* buf, size_t len, ini_handler handler,
+                     ini_parser_config c, void* user);
+
+/* Scan INI data in a buffer of len bytes for section headers only, calling
+   handler with name and value NULL for each [section] line. Lines are split
+   and classified as ini_parse_stream() would, including multi-line
+   continuations, but name=value pairs are not passed to handler, except that
+   the first pair before any section is passed with an empty name and value so
+   the caller can tell that pairs outside any section exist. Returns 0 on
+   success or line number of first section line missing its ']'. */
+int ini_scan_sections(const char* buf, size_t len, ini_handler handler,
+                      ini_parser_config c, void* user);
+
 /* Nonzero to allow multi-line value parsing, in the style of Python's
-   configparser. If allowed, ini_parse() will call the handler with the same
-   name for each subsequent line parsed. */
+   configparser. If allowed and the multi config field is set, ini_parse()
+   will join each subsequent line parsed onto the value with the join config
+   character and call the handler once with the whole value. */
 #ifndef INI_ALLOW_MULTILINE
 #define INI_ALLOW_MULTILINE 1
 #endif
@@ -130,6 +148,13 @@ int ini_parse_string(const char* string, ini_handler handler, ini_parser_config
 #define INI_INITIAL_ALLOC 200
 #endif
 
+/* Nonzero to compile a separate parser for each common combination of the
+   multi and seps config fields, chosen once per parse, instead of a single
+   parser that tests them on every line. */
+#ifndef INI_SPECIALIZE_PARSERS
+#define INI_SPECIALIZE_PARSERS 1
+#endif
+
 /* Stop parsing on first error (default is to keep parsing). */
 #ifndef INI_STOP_ON_FIRST_ERROR
 #define INI_STOP_ON_FIRST_ERROR 0
@@ -149,6 +174,102 @@ int ini_parse_string(const char* string, ini_handler handler, ini_parser_config
 #define INI_ALLOW_NO_VALUE 0
 #endif
 
+/* Size of the buffer holding the current section name, including its
+   terminating null. Longer section names are truncated. */
+#ifndef INI_MAX_SECTION
+#define INI_MAX_SECTION 50
+#endif
+
+/* Types of event returned by ini_reader_next(). */
+enum {
+    INI_EVENT_SECTION = 1,  /* a [section] line; section is the new name */
+    INI_EVENT_PAIR,         /* a name[seps]value line */
+    INI_EVENT_CONTINUATION, /* a line continuing the last pair's value */
+    INI_EVENT_ERROR         /* a line that could not be parsed */
+};
+
+/* Part of the input, not null-terminated unless noted. */
+typedef struct {
+    const char* ptr;
+    size_t len;
+} ini_slice;
+
+/* Event returned by ini_reader_next(). section is the null-terminated name of
+   the current section, "" before any [section] line. name and value are the
+   stripped name and value of a pair, or value is the stripped line of a
+   continuation. value.ptr is NULL for a name without a value. */
+typedef struct {
+    int type;
+    int lineno;
+    const char* section;
+    ini_slice name;
+    ini_slice value;
+} ini_event;
+
+/* State of a pull parser. Fields are private. */
+typedef struct ini_reader_state ini_reader_state;
+struct ini_reader_state {
+    int (*next)(ini_reader_state* state, ini_event* event);
+    ini_parser_config c;
+    const char* ptr;
+    const char* end;
+    ini_reader reader;
+    void* stream;
+#if INI_USE_STACK
+    char line[INI_MAX_LINE];
+#else
+    char* line;
+#endif
+    size_t max_line;
+    int lineno;
+    int has_prev_name;
+    char section[INI_MAX_SECTION];
+};
+
+/* Start pulling events from a buffer of len bytes, which must outlive the
+   state. Slices point into the buffer and are not null-terminated. */
+void ini_reader_init_buffer(ini_reader_state* state, const char* buf,
+                            size_t len, ini_parser_config c);
+
+/* Start pulling events from lines read by reader. Slices point into a line
+   buffer owned by the state, are null-terminated, and are only valid until
+   the next call to ini_reader_next(). Returns 0 on success or -2 on memory
+   allocation error (only when INI_USE_STACK is zero). */
+int ini_reader_init_stream(ini_reader_state* state, ini_reader reader,
+                           void* stream, ini_parser_config c);
+
+/* Read up to the next line that makes an event and fill in event. Blank and
+   comment lines are skipped. Continuation events are only returned when the
+   multi config field is set. Returns 1 if an event was read, 0 at the end of
+   input, or -2 on memory allocation error. Parsing can stop after any event,
+   and ini_parse_stream() is a loop over this calling the handler. */
+int ini_reader_next(ini_reader_state* state, ini_event* event);
+
+/* Free memory held by a state. */
+void ini_reader_free(ini_reader_state* state);
+
+/* State of a section header scan over input given a chunk at a time. Fields
+   are private, except error, which is 0 or the line number of the first
+   section line missing its ']'. */
+typedef struct {
+    ini_parser_config c;
+    int lineno;
+    int error;
+    int has_prev_name;
+    int in_section;
+    char section[INI_MAX_SECTION];
+} ini_scan_state;
+
+/* Start a scan like ini_scan_sections() of input given a chunk at a time. */
+void ini_scan_init(ini_scan_state* state, ini_parser_config c);
+
+/* Scan the complete lines of a chunk of len bytes, calling handler as
+   ini_scan_sections() does, or every line if last is set. Returns the number
+   of bytes scanned; the rest is a partial line, shorter than the longest line
+   read in one go, which must start the next chunk. */
+size_t ini_scan_chunk(ini_scan_state* state, const char* buf, size_t len,
+                      int last, ini_handler handler, void* user);
+
 #ifdef __cplusplus
 }
 #endif
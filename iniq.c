@@ -1,12 +1,33 @@
 /* This project is licensed under the New BSD License (see LICENSE). */
 
+#include <ctype.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#if INIQ_STATS
+#include <sys/resource.h>
+#include <time.h>
+#endif /* INIQ_STATS */
+
+#if INIQ_ZLIB
+#include <zlib.h>
+#endif /* INIQ_ZLIB */
+#if INIQ_USDT
+#include <sys/sdt.h>
+#endif /* INIQ_USDT */
+
 #include "inih/ini.h"
+#include "io.h"
 
 #ifndef VERSION
 #define VERSION ""
@@ -14,28 +35,260 @@
 
 #define NO_SECTION "."
 #define DEFAULT_SECTION "DEFAULT"
+#define CONF_SUFFIX ".conf"
 #define streq(s1, s2) (strcmp((s1), (s2)) == 0)
 
+/* Sections with at least this many pairs get a sorted key index the second
+   time they are searched. Smaller sections are faster to scan. */
+#define INDEX_MIN_PAIRS 16
+
+/* Bits of a document's Bloom filter per stored pair, and bits set per pair
+   within its 64-bit block. About 2% of missing keys get past the filter. */
+#define BLOOM_BITS_PER_PAIR 12
+#define BLOOM_PROBES 4
+#define BLOOM_MIN_PAIRS 4
+
+/* Values starting with these would read back as a comment after a space. */
+#if INI_ALLOW_INLINE_COMMENTS
+#define VALUE_START_COMMENTS INI_INLINE_COMMENT_PREFIXES
+#else
+#define VALUE_START_COMMENTS ""
+#endif
+
+#if INIQ_STATS
+#define STAT(expr) (expr)
+#else
+#define STAT(expr) ((void)0)
+#endif /* INIQ_STATS */
+
+/* Static tracepoints in the iniq provider. A probe is a nop until a tracer
+   attaches to it, and without USDT=1 its arguments aren't even evaluated. */
+#if INIQ_USDT
+#define PROBE(name) DTRACE_PROBE(iniq, name)
+#define PROBE1(name, a) DTRACE_PROBE1(iniq, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(iniq, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(iniq, name, a, b, c)
+#else
+#define PROBE(name) ((void)0)
+#define PROBE1(name, a) ((void)0)
+#define PROBE2(name, a, b) ((void)0)
+#define PROBE3(name, a, b, c) ((void)0)
+#endif /* INIQ_USDT */
+
+enum {
+    OPT_STATS = 256,
+    OPT_EXPORT,
+    OPT_DIFF,
+    OPT_SET,
+    OPT_DELETE,
+};
+
+/* Flags describing a stored string, computed once when it is parsed. */
+enum {
+    STR_SPACE = 1 << 0,
+    STR_QUOTED = 1 << 1,
+};
+
 struct pair {
     const char *key;
     const char *value;
+    size_t key_len;
+    size_t value_len;
+    size_t hash; // of the key
+    unsigned int key_flags;
+    unsigned int value_flags;
     struct pair *next;
 };
 
+/* Blocked Bloom filter over the (section name, key) pairs of a document, so
+   that looking up a key that isn't there usually costs a few hash operations
+   and one word of memory instead of a search of the section. */
+struct bloom {
+    uint64_t *blocks;
+    size_t mask;
+};
+
 struct section {
     const char *name;
+    size_t name_len;
+    size_t hash; // of the name
+    unsigned int name_flags;
     struct pair *pairs;
+    struct pair *last;
+    // pairs sorted by key, first occurrence of each key only
+    struct pair **index;
+    size_t nindex;
+    size_t npairs;
+    unsigned int lookups;
+    // filter of the document holding the section, once built
+    const struct bloom *bloom;
+    // index among the sections of the same name, and the next of them
+    unsigned int nth;
+    struct section *same;
     struct section *next;
 };
 
+/* Slot of a document's hash table of section names, holding the first and
+   last sections with a name. */
+struct section_slot {
+    size_t hash;
+    struct section *first;
+    struct section *last;
+};
+
+/* Compiled section or key pattern. Braces are expanded into alternatives
+   once, then each alternative is compared as a literal string, or, if the
+   pattern contains wildcards, matched as a glob where '*' matches any run of
+   characters, '?' matches one character and '\\' escapes the next one. */
+struct pattern {
+    char **alts;
+    size_t nalts;
+    int glob;
+};
+
+/* Query pushed into the parser so that sections and keys it can't touch are
+   discarded at parse time instead of being stored. A NULL section keeps all
+   sections and a NULL key keeps all pairs. With first_only, a single literal
+   key is wanted from the index'th section and parsing stops once it's found,
+   as later occurrences of the key never override it. */
+struct query {
+    const struct pattern *section;
+    const struct pattern *key;
+    int sectionless;
+    int no_pairs;
+    int headers_only;
+    int first_only;
+    unsigned int index;
+};
+
+/* Parsed file. When several files are layered, each is parsed into its own
+   document and later ones are merged into the first. */
+struct document {
+    const struct query *query;
+    struct section *sections;
+    struct section *last_section;
+    struct section_slot *slots;
+    size_t nslots;
+    size_t nnames;
+    struct bloom bloom;
+    int done;
+    // an allocation failed while parsing, leaving the document incomplete
+    int failed;
+};
+
+/* Open-addressing hash table of the first pair with each key in a section,
+   so that sections are diffed in time linear in their size. */
+struct pair_table {
+    struct pair **slots;
+    size_t mask;
+};
+
+/* One side of a section diff: the section, which may be missing, and the
+   DEFAULT section it inherits from, if any. */
+struct diff_side {
+    const struct section *s;
+    struct pair_table own;
+    const struct pair_table *defaults;
+};
+
+/* Shell assignment printed by --export, of the value of p in section. */
+struct export {
+    char *name;
+    const char *section;
+    const struct pair *p;
+};
+
+/* Key to set or delete, from --set SECTION.KEY=VALUE or --delete
+   SECTION.KEY. */
+struct edit {
+    const char *arg;
+    char *section;
+    char *key;
+    size_t key_len;
+    const char *value; // NULL to delete
+    // number of sections of the name seen, whether the edit applies to the
+    // current one, and whether the value is written
+    unsigned int seen;
+    int active;
+    int done;
+    int overridden;
+};
+
+/* Input of the edits, a file read a line at a time or a mapped buffer. The
+   bytes at offsets [base, pos) of a file are held until they are written, as
+   the parser strips the lines it reads. */
+struct edit_input {
+    FILE *file;
+    const char *data;
+    const char *buf;
+    const char *end;
+    char *held;
+    size_t size;
+    size_t base;
+    size_t pos;
+    // offset of the last line read and where the parser has it
+    size_t line;
+    const char *str;
+    // offset past a byte order mark, and the last byte read
+    size_t start;
+    int last;
+};
+
+/* Work shared by the threads parsing layers in parallel. errs[i] is set if
+   layer i failed to parse. */
+struct layer_jobs {
+    pthread_mutex_t lock;
+    ini_parser_config c;
+    struct file_buf *bufs;
+    size_t next;
+    int *errs;
+};
+
 static int quiet = 0;
+// like diff(1), --diff exits with 1 for differences and 2 for errors
+static int error_status = EXIT_FAILURE;
+static char *input_name = NULL;
 static int include_default = 0;
 static int disable_default = 0;
 static int combine_sections = 0;
 static int number_sections = 0;
+static const char *export_prefix = NULL;
 static char *path_sep = ".";
 static char *path_dup = NULL;
-static struct section *sections = NULL;
+static struct pattern *section_pattern = NULL;
+static struct pattern *key_pattern = NULL;
+static struct pattern *filter_pattern = NULL;
+static struct pattern *where_key = NULL;
+static struct pattern *where_value = NULL;
+static const char **files = NULL;
+static size_t nfiles = 0;
+static struct document *layers = NULL;
+static struct export *exports = NULL;
+static size_t nexports = 0;
+static struct edit *edits = NULL;
+static size_t nedits = 0;
+static char *edit_tmp = NULL;
+
+#if INIQ_STATS
+static struct {
+    size_t bytes;
+    size_t lines;
+    size_t line_len;
+    size_t max_line;
+    size_t sections;
+    size_t duplicates;
+    size_t pairs;
+    size_t stored_pairs;
+    size_t bloom_rejects;
+    size_t allocs;
+    size_t alloc_bytes;
+    struct timespec start;
+    struct timespec parsed;
+    struct timespec queried;
+    int enabled;
+    int json;
+} stats;
+#endif /* INIQ_STATS */
 
 static void
 die(const char *fmt, ...)
@@ -48,7 +301,87 @@ die(const char *fmt, ...)
         va_end(ap);
     }
 
-    exit(EXIT_FAILURE);
+    exit(error_status);
+}
+
+/* Allocate like malloc(). Parsing, which runs in threads that can't exit,
+   uses this and the other try_ functions and reports failures; everything
+   else uses the x functions, which die. */
+static void *
+try_malloc(size_t size)
+{
+    void *p = malloc(size);
+
+    if (p) {
+        STAT(stats.allocs++);
+        STAT(stats.alloc_bytes += size);
+    }
+
+    return p;
+}
+
+static void *
+try_realloc(void *ptr, size_t size)
+{
+    void *p = realloc(ptr, size);
+
+    if (p) {
+        STAT(stats.allocs++);
+        STAT(stats.alloc_bytes += size);
+    }
+
+    return p;
+}
+
+static char *
+try_memdup(const char *str, size_t len)
+{
+    char *s = try_malloc(len + 1);
+
+    if (s) {
+        memcpy(s, str, len);
+        s[len] = '\0';
+    }
+    return s;
+}
+
+static void *
+xmalloc(size_t size)
+{
+    void *p = try_malloc(size);
+
+    if (!p)
+        die("failed to allocate memory\n");
+
+    return p;
+}
+
+static void *
+xrealloc(void *ptr, size_t size)
+{
+    void *p = try_realloc(ptr, size);
+
+    if (!p)
+        die("failed to allocate memory\n");
+
+    return p;
+}
+
+static char *
+xstrdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+
+    return memcpy(xmalloc(len), str, len);
+}
+
+static char *
+xmemdup(const char *str, size_t len)
+{
+    char *s = memcpy(xmalloc(len + 1), str, len);
+
+    s[len] = '\0';
+    return s;
 }
 
 static void
@@ -65,14 +398,27 @@ free_section(struct section *s)
         free(p);
     }
 
+    free(s->index);
     free((void *)s->name);
     free(s);
 }
 
 static void
-cleanup(void)
+free_pattern(struct pattern *pat)
 {
-    struct section *head = sections;
+    if (!pat)
+        return;
+
+    for (size_t i = 0; i < pat->nalts; i++)
+        free(pat->alts[i]);
+    free(pat->alts);
+    free(pat);
+}
+
+static void
+free_document(struct document *doc)
+{
+    struct section *head = doc->sections;
 
     while (head) {
         struct section *s = head;
@@ -80,18 +426,76 @@ cleanup(void)
         free_section(s);
     }
 
+    doc->sections = doc->last_section = NULL;
+    free(doc->slots);
+    doc->slots = NULL;
+    doc->nslots = doc->nnames = 0;
+    free(doc->bloom.blocks);
+    doc->bloom.blocks = NULL;
+}
+
+static void
+cleanup(void)
+{
+    // flush output here rather than in exit() so tracers see when it's done
+    fflush(stdout);
+    PROBE(output__flush);
+
+    if (layers) {
+        for (size_t i = 0; i < (nfiles ? nfiles : 1); i++)
+            free_document(&layers[i]);
+        free(layers);
+    }
+    for (size_t i = 0; i < nfiles; i++)
+        free((void *)files[i]);
+    free(files);
+
+    for (size_t i = 0; i < nexports; i++)
+        free(exports[i].name);
+    free(exports);
+
+    for (size_t i = 0; i < nedits; i++) {
+        free(edits[i].section);
+        free(edits[i].key);
+    }
+    free(edits);
+    if (edit_tmp) {
+        unlink(edit_tmp);
+        free(edit_tmp);
+    }
+
+    free(input_name);
     free(path_dup);
+    free_pattern(section_pattern);
+    free_pattern(key_pattern);
+    free_pattern(filter_pattern);
+    free_pattern(where_key);
+    free_pattern(where_value);
 }
 
-static int
-quote_str(const char *str, char **out)
+/* Return the length of str and store its STR_* flags in flags. */
+static size_t
+str_info(const char *str, unsigned int *flags)
 {
-    size_t len = strlen(str);
+    size_t len = 0;
+
+    *flags = 0;
+    for (; str[len]; len++) {
+        if (str[len] == ' ')
+            *flags |= STR_SPACE;
+    }
+
+    if (len > 0 && (str[0] == '\'' || str[0] == '"') && str[len-1] == str[0])
+        *flags |= STR_QUOTED;
+
+    return len;
+}
 
+static int
+quote_str(const char *str, size_t len, unsigned int flags, char **out)
+{
     // do not quote string if it has no spaces or is already quoted
-    if (!str || !strstr(str, " ") ||
-        (str[0] == '\'' && str[len-1] == '\'') ||
-        (str[0] == '"' && str[len-1] == '"')) {
+    if (!(flags & STR_SPACE) || (flags & STR_QUOTED)) {
         *out = (char *)str;
         return 0;
     }
@@ -99,73 +503,207 @@ quote_str(const char *str, char **out)
     // +1 for \0, +2 for both quotes
     len += 3;
 
-    *out = malloc(len * sizeof(char));
+    *out = xmalloc(len * sizeof(char));
     snprintf(*out, len, "'%s'", str);
 
     return 1;
 }
 
-char **
-split_str(char *str, const char delim)
+static void
+add_alt(struct pattern *pat, char *alt)
+{
+    pat->alts = xrealloc(pat->alts, sizeof(char *) * (pat->nalts + 1));
+    pat->alts[pat->nalts++] = alt;
+}
+
+static void
+expand_braces(struct pattern *pat, const char *str)
 {
-    char *tmp = str;
-    char *last_delim = NULL;
-    int len = 0;
+    const char *open = NULL;
+    const char *close = NULL;
+    int depth = 0;
+
+    for (const char *c = str; *c && !close; c++) {
+        if (*c == '\\' && c[1])
+            c++;
+        else if (*c == '{' && depth++ == 0)
+            open = c;
+        else if (*c == '}' && depth > 0 && --depth == 0)
+            close = c;
+    }
 
-    // count delimiters to determine length
-    while (*tmp) {
-        if (*tmp == delim) {
-            len++;
-            last_delim = tmp;
+    if (!close) {
+        add_alt(pat, xstrdup(str));
+        return;
+    }
+
+    size_t prefix = open - str;
+    size_t suffix = strlen(close + 1);
+    const char *opt = open + 1;
+
+    // expand each comma-separated option, recursing for later braces
+    for (const char *c = open + 1; c <= close; c++) {
+        if (*c == '\\' && c < close - 1) {
+            c++;
+        } else if (*c == '{') {
+            depth++;
+        } else if (*c == '}' && depth > 0) {
+            depth--;
+        } else if ((*c == ',' && depth == 0) || c == close) {
+            size_t len = c - opt;
+            char *alt = xmalloc(prefix + len + suffix + 1);
+
+            memcpy(alt, str, prefix);
+            memcpy(alt + prefix, opt, len);
+            memcpy(alt + prefix + len, close + 1, suffix + 1);
+            expand_braces(pat, alt);
+            free(alt);
+            opt = c + 1;
         }
-        tmp++;
     }
-    // add space for last token
-    len += last_delim < (str + strlen(str) - 1);
-    // add space for NULL terminator
-    len++;
+}
 
-    char **ret = malloc(sizeof(char *) * len);
-    char *tok = strtok(str, &delim);
-    int i = 0;
+/* Return a copy of str with its unbalanced braces escaped, so that they are
+   matched literally as they were before braces were patterns. */
+static char *
+escape_unbalanced(const char *str)
+{
+    size_t len = strlen(str);
+    // 1 for each brace of str that has a partner
+    char *balanced = xmalloc(len + 1);
+    size_t *open = xmalloc(sizeof(size_t) * (len + 1));
+    size_t depth = 0;
+
+    memset(balanced, 0, len + 1);
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] == '\\' && str[i + 1])
+            i++;
+        else if (str[i] == '{')
+            open[depth++] = i;
+        else if (str[i] == '}' && depth > 0)
+            balanced[open[--depth]] = balanced[i] = 1;
+    }
+    // at worst every character is an escaped brace
+    char *out = xmalloc(len * 2 + 1);
+    char *w = out;
+
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] == '\\' && str[i + 1]) {
+            *w++ = str[i++];
+        } else if ((str[i] == '{' || str[i] == '}') && !balanced[i]) {
+            *w++ = '\\';
+        }
+        *w++ = str[i];
+    }
+    *w = '\0';
 
-    // char str_delim[2] = { delim, 0 };
+    free(open);
+    free(balanced);
+    return out;
+}
 
-    while (tok) {
-        ret[i] = strdup(tok);
-        tok = strtok(NULL, &delim);
-        i++;
+static struct pattern *
+compile_pattern(const char *arg, int list)
+{
+    struct pattern *pat = xmalloc(sizeof(struct pattern));
+    char *str = escape_unbalanced(arg);
+
+    pat->alts = NULL;
+    pat->nalts = 0;
+    pat->glob = 0;
+
+    for (const char *c = str; *c; c++) {
+        if (*c == '\\' && c[1])
+            c++;
+        else if (*c == '*' || *c == '?' || *c == '{')
+            pat->glob = 1;
+    }
+
+    if (list) {
+        // a comma-separated list is a brace expression without the braces
+        size_t len = strlen(str);
+        char *braced = xmalloc(len + 3);
+
+        snprintf(braced, len + 3, "{%s}", str);
+        expand_braces(pat, braced);
+        free(braced);
+    } else {
+        expand_braces(pat, str);
+    }
+    free(str);
+
+    if (!pat->glob) {
+        // literal patterns are compared as is, except for escaped wildcards
+        for (size_t i = 0; i < pat->nalts; i++) {
+            char *r = pat->alts[i];
+            char *w = r;
+
+            for (; *r; r++) {
+                if (*r == '\\' && r[1] && strchr("*?{},", r[1]))
+                    r++;
+                *w++ = *r;
+            }
+            *w = '\0';
+        }
     }
-    ret[i] = NULL;
 
-    return ret;
+    return pat;
 }
 
-static void
-free_strs(char **strs)
+static int
+glob_match(const char *pat, const char *str)
 {
-    for (int i = 0; strs[i]; i++) {
-        free(strs[i]);
+    const char *star = NULL;
+    const char *retry = NULL;
+
+    while (*str) {
+        int escaped = *pat == '\\' && pat[1];
+
+        if (*pat == '*') {
+            star = ++pat;
+            retry = str;
+        } else if (*pat == '?' || (*pat && pat[escaped] == *str)) {
+            pat += *pat == '?' ? 1 : escaped + 1;
+            str++;
+        } else if (star) {
+            // let the last '*' swallow one more character
+            pat = star;
+            str = ++retry;
+        } else {
+            return 0;
+        }
     }
-    free(strs);
+
+    while (*pat == '*')
+        pat++;
+
+    return !*pat;
 }
 
 static int
-has_str(char **strs, const char *str)
+pattern_match(const struct pattern *pat, const char *str)
 {
-    for (int i = 0; strs[i]; i++) {
-        if (streq(strs[i], str))
+    for (size_t i = 0; i < pat->nalts; i++) {
+        if (pat->glob ? glob_match(pat->alts[i], str) :
+                streq(pat->alts[i], str))
             return 1;
     }
     return 0;
 }
 
+static int
+section_match(const struct pattern *pat, const char *name)
+{
+    // wildcards never match pairs outside any section
+    return (*name || !pat->glob) && pattern_match(pat, name);
+}
+
 static void
 print_pair(const char *fmt, struct pair *p, int keys, int sep)
 {
     char *key, *val;
-    int qkey = quote_str(p->key, &key);
-    int qval = quote_str(p->value, &val);
+    int qkey = quote_str(p->key, p->key_len, p->key_flags, &key);
+    int qval = quote_str(p->value, p->value_len, p->value_flags, &val);
     char *k, *v;
 
     if (!fmt) {
@@ -180,7 +718,7 @@ print_pair(const char *fmt, struct pair *p, int keys, int sep)
         return;
     }
 
-    fmt = strdup(fmt);
+    fmt = xstrdup(fmt);
     k = strstr(fmt, "%k");
     v = strstr(fmt, "%v");
 
@@ -212,26 +750,171 @@ print_pair(const char *fmt, struct pair *p, int keys, int sep)
     if (qval) free(val);
 }
 
+struct index_entry {
+    struct pair *pair;
+    size_t pos;
+};
+
+static int
+cmp_index_entry(const void *a, const void *b)
+{
+    const struct index_entry *ea = a;
+    const struct index_entry *eb = b;
+    int r = strcmp(ea->pair->key, eb->pair->key);
+
+    if (r)
+        return r;
+    // keep file order among equal keys so the first one is indexed
+    return (ea->pos > eb->pos) - (ea->pos < eb->pos);
+}
+
+static int
+cmp_index_key(const void *key, const void *elem)
+{
+    return strcmp(key, (*(struct pair *const *)elem)->key);
+}
+
+static void
+build_index(struct section *s)
+{
+    struct index_entry *entries = xmalloc(sizeof(*entries) * s->npairs);
+    size_t n = 0;
+
+    for (struct pair *p = s->pairs; p; p = p->next, n++) {
+        entries[n].pair = p;
+        entries[n].pos = n;
+    }
+
+    qsort(entries, n, sizeof(*entries), cmp_index_entry);
+
+    s->index = xmalloc(sizeof(struct pair *) * n);
+    s->nindex = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0 && streq(entries[i].pair->key, entries[i - 1].pair->key))
+            continue;
+        s->index[s->nindex++] = entries[i].pair;
+    }
+
+    free(entries);
+}
+
+static size_t
+hash_name(const char *name)
+{
+    // FNV-1a
+    size_t hash = 2166136261u;
+
+    for (; *name; name++)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return hash;
+}
+
+/* Return the hash of a key in the section whose name hashes to section_hash,
+   with its bits mixed so any of them can pick a block or a bit. */
+static uint64_t
+bloom_hash(size_t section_hash, size_t key_hash)
+{
+    uint64_t h = (uint64_t)section_hash * 0x9E3779B97F4A7C15u ^ key_hash;
+
+    // finalizer of MurmurHash3
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDu;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53u;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Return the bits of the block a hash sets: the low bits pick the block and
+   each probe takes six of the high bits. */
+static uint64_t
+bloom_bits(uint64_t h)
+{
+    uint64_t bits = 0;
+
+    for (int i = 0; i < BLOOM_PROBES; i++)
+        bits |= (uint64_t)1 << ((h >> (64 - 6 * (i + 1))) & 63);
+    return bits;
+}
+
+/* Build the Bloom filter of doc's pairs, once all are stored. */
+static void
+build_bloom(struct document *doc)
+{
+    struct bloom *b = &doc->bloom;
+    size_t n = 0;
+    size_t nblocks = 1;
+
+    for (struct section *s = doc->sections; s; s = s->next)
+        n += s->npairs;
+    if (n == 0 || b->blocks)
+        return;
+
+    while (nblocks * 64 < n * BLOOM_BITS_PER_PAIR)
+        nblocks *= 2;
+    b->blocks = xmalloc(sizeof(uint64_t) * nblocks);
+    memset(b->blocks, 0, sizeof(uint64_t) * nblocks);
+    b->mask = nblocks - 1;
+
+    for (struct section *s = doc->sections; s; s = s->next) {
+        for (struct pair *p = s->pairs; p; p = p->next) {
+            uint64_t h = bloom_hash(s->hash, p->hash);
+            b->blocks[h & b->mask] |= bloom_bits(h);
+        }
+        s->bloom = b;
+    }
+}
+
+/* Return the first pair of s with key, whose hash_name() is hash. */
+static struct pair *
+find_pair(struct section *s, const char *key, size_t hash)
+{
+    // scanning a few pairs is as fast as the filter
+    if (s->bloom && s->npairs >= BLOOM_MIN_PAIRS) {
+        uint64_t h = bloom_hash(s->hash, hash);
+        uint64_t bits = bloom_bits(h);
+
+        if ((s->bloom->blocks[h & s->bloom->mask] & bits) != bits) {
+            STAT(stats.bloom_rejects++);
+            return NULL;
+        }
+    }
+
+    if (!s->index && s->lookups++ > 0 && s->npairs >= INDEX_MIN_PAIRS)
+        build_index(s);
+
+    if (s->index) {
+        struct pair **p = bsearch(key, s->index, s->nindex,
+                sizeof(struct pair *), cmp_index_key);
+        return p ? *p : NULL;
+    }
+
+    for (struct pair *p = s->pairs; p; p = p->next) {
+        if (streq(p->key, key))
+            return p;
+    }
+
+    return NULL;
+}
+
 static int
 print_pairs(const char *fmt, struct section *s, struct section *d, int keys,
-        int sep, char **filter, int dry_run)
+        int sep, const struct pattern *filter, int dry_run)
 {
     int di = 0;
     int si = 0;
 
     for (struct pair *p = s->pairs; p; p = p->next) {
-        if (!filter || has_str(filter, p->key))
+        if (!filter || pattern_match(filter, p->key))
             si++;
     }
 
     if (d) {
         // print keys inherited from DEFAULT if key is not redefined in section
         for (struct pair *dp = d->pairs; dp; dp = dp->next) {
-            for (struct pair *sp = s->pairs; sp; sp = sp->next) {
-                if (streq(dp->key, sp->key))
-                    goto outer;
-            }
-            if (filter && !has_str(filter, dp->key))
+            if (find_pair(s, dp->key, dp->hash))
+                continue;
+            if (filter && !pattern_match(filter, dp->key))
                 continue;
             if (!dry_run) {
                 if (di > 0)
@@ -239,7 +922,6 @@ print_pairs(const char *fmt, struct section *s, struct section *d, int keys,
                 print_pair(fmt, dp, keys, -1);
             }
             di++;
-        outer: continue;
         }
 
         if (!dry_run && di > 0 && si > 0)
@@ -248,7 +930,7 @@ print_pairs(const char *fmt, struct section *s, struct section *d, int keys,
 
     int i = 0;
     for (struct pair *p = s->pairs; p; p = p->next) {
-        if (filter && !has_str(filter, p->key))
+        if (filter && !pattern_match(filter, p->key))
             continue;
         if (!dry_run)
             print_pair(fmt, p, keys, ++i < si ? sep : -1);
@@ -258,14 +940,14 @@ print_pairs(const char *fmt, struct section *s, struct section *d, int keys,
 }
 
 static int
-print_sections(const char *fmt)
+print_sections(const struct document *doc, const char *fmt)
 {
     if (fmt && !strstr(fmt, "%s"))
         die("invalid format string: use %%s for section\n");
 
     int i = 0;
 
-    for (struct section *s = sections; s; s = s->next, i++) {
+    for (struct section *s = doc->sections; s; s = s->next, i++) {
         if (!strlen(s->name) ||
                 (!include_default && streq(s->name, DEFAULT_SECTION)))
             continue;
@@ -279,125 +961,1889 @@ print_sections(const char *fmt)
 static int
 print_value(const char *fmt, struct section *s, const char *key)
 {
-    if (!s)
+    struct pair *p = s ? find_pair(s, key, hash_name(key)) : NULL;
+
+    PROBE3(query__value, s ? s->name : NULL, key, p != NULL);
+    if (!p)
         return 0;
 
-    for (struct pair *p = s->pairs; p; p = p->next) {
-        if (streq(p->key, key)) {
-            print_pair(fmt ? fmt : "%v", p, 0, '\n');
-            return 1;
-        }
-    }
+    print_pair(fmt ? fmt : "%v", p, 0, '\n');
 
-    return 0;
+    return 1;
 }
 
 static int
-print_output(const char *fmt, char *filter, struct section *d)
+print_output(const struct document *doc, const char *fmt,
+        const struct pattern *names, const struct pattern *keys,
+        struct section *d)
 {
-    char **keys = NULL;
-    if (filter)
-        keys = split_str(filter, ',');
-
     int i = 0;
 
-    for (struct section *s = sections; s; s = s->next, i++) {
+    for (struct section *s = doc->sections; s; s = s->next) {
         if (!include_default && streq(s->name, DEFAULT_SECTION))
             continue;
+        if (names && !section_match(names, s->name))
+            continue;
         // dry run to count keys
         int n = print_pairs(fmt, s, d, 0, -1, keys, 1);
-        if (filter && n == 0)
+        if (keys && n == 0)
             continue;
-        struct pair p = {"section", s->name, NULL};
+        struct pair p = {"section", s->name, 7, s->name_len, 0, 0, s->name_flags,
+            NULL};
         print_pair(fmt, &p, 0, -1);
         if (n > 0)
             printf("%c", ' ');
         print_pairs(fmt, s, d, 0, ' ', keys, 0);
         printf("\n");
+        i++;
     }
 
-    if (keys)
-        free_strs(keys);
-
     return i;
 }
 
-static int
-handler(void *user, const char *section, const char *key, const char *value)
+
+/* Return the pair of s, or of the DEFAULT section d it inherits from, whose
+   key matches keys and value matches values. Only the first occurrence of a
+   key counts, as when getting a single key. */
+static struct pair *
+find_where(struct section *s, struct section *d, const struct pattern *keys,
+        const struct pattern *values)
 {
-    // unused user data
-    (void)user;
+    struct pair *p;
 
-    int default_section = streq(section, DEFAULT_SECTION);
-    struct section *s = NULL;
-    struct section *n;
+    if (!keys->glob) {
+        for (size_t i = 0; i < keys->nalts; i++) {
+            const char *key = keys->alts[i];
+            size_t hash = hash_name(key);
 
-    if (disable_default && default_section)
-        return 1;
+            if (!(p = find_pair(s, key, hash)) && d)
+                p = find_pair(d, key, hash);
+            if (p && pattern_match(values, p->value))
+                return p;
+        }
+        return NULL;
+    }
 
-    for (n = sections; n; n = n->next) {
-        if (streq(n->name, section))
-            s = n;
+    for (p = s->pairs; p; p = p->next) {
+        if (pattern_match(keys, p->key) && find_pair(s, p->key, p->hash) == p &&
+                pattern_match(values, p->value))
+            return p;
+    }
+    for (p = d ? d->pairs : NULL; p; p = p->next) {
+        if (pattern_match(keys, p->key) && find_pair(d, p->key, p->hash) == p &&
+                !find_pair(s, p->key, p->hash) &&
+                pattern_match(values, p->value))
+            return p;
     }
 
-    if (!s || !(key || default_section || combine_sections)) {
-        s = malloc(sizeof(struct section));
-        s->name = strdup(section);
-        s->pairs = NULL;
-        s->next = NULL;
+    return NULL;
+}
 
-        if (sections) {
-            struct section *tail = sections;
-            // append so sections are in config order
-            while (tail->next)
-                tail = tail->next;
-            tail->next = s;
-        } else {
-            sections = s;
-        }
+/* Print the sections matching names, or all of them, where a key matching
+   where_key has a value matching where_value, and return how many there
+   are. */
+static int
+print_where(const struct document *doc, const char *fmt,
+        const struct pattern *names, struct section *d)
+{
+    if (fmt && !strstr(fmt, "%s"))
+        die("invalid format string: use %%s for section\n");
+
+    int n = 0;
+
+    for (struct section *s = doc->sections; s; s = s->next) {
+        if (!*s->name || (!include_default && streq(s->name, DEFAULT_SECTION)))
+            continue;
+        if (names && !section_match(names, s->name))
+            continue;
+        if (!find_where(s, s == d ? NULL : d, where_key, where_value))
+            continue;
+        printf(fmt ? fmt : "%s", s->name);
+        printf("\n");
+        n++;
     }
 
-    if (!key)
+    return n;
+}
+
+static void
+append_pair(struct section *s, struct pair *p)
+{
+    if (s->last)
+        s->last->next = p;
+    else
+        s->pairs = p;
+    s->last = p;
+    s->npairs++;
+}
+
+static int
+wanted_section(const struct query *q, const char *section, int default_section)
+{
+    if (!q->section || section_match(q->section, section))
         return 1;
+    // DEFAULT is only inherited by real sections
+    return default_section && !q->sectionless;
+}
 
-    struct pair *p = malloc(sizeof(struct pair));
-    p->key = strdup(key);
-    p->value = strdup(value);
-    p->next = NULL;
+static int
+wanted_key(const struct query *q, const char *key)
+{
+    if (q->no_pairs)
+        return 0;
+    return !q->key || pattern_match(q->key, key);
+}
 
-    if (s->pairs) {
-        struct pair *tail = s->pairs;
-        while (tail->next)
-            tail = tail->next;
-        tail->next = p;
-    } else {
-        s->pairs = p;
+/* Return the slot of name in doc's section table, or the empty slot where it
+   goes. The table must have slots. */
+static struct section_slot *
+section_slot(const struct document *doc, const char *name, size_t hash)
+{
+    size_t mask = doc->nslots - 1;
+    size_t i = hash & mask;
+
+    for (; doc->slots[i].first; i = (i + 1) & mask) {
+        struct section_slot *slot = &doc->slots[i];
+        if (slot->hash == hash && streq(slot->first->name, name))
+            break;
     }
 
-    return 1;
+    return &doc->slots[i];
 }
 
-static struct section *
-get_section(const char *name, unsigned int i)
+/* Add s to doc, or return -1 if the section table can't grow to take it. */
+static int
+append_section(struct document *doc, struct section *s)
 {
-    // keys with no section are stored under "" section in inih
-    if (streq(name, NO_SECTION))
-        name = "";
+    // keep the table at most half full so probe sequences stay short
+    if ((doc->nnames + 1) * 2 > doc->nslots) {
+        size_t nslots = doc->nslots ? doc->nslots * 2 : 64;
+        struct section_slot *slots =
+            try_malloc(sizeof(struct section_slot) * nslots);
+        struct section_slot *old = doc->slots;
+        size_t nold = doc->nslots;
+
+        if (!slots)
+            return -1;
+        memset(slots, 0, sizeof(struct section_slot) * nslots);
+        doc->slots = slots;
+        doc->nslots = nslots;
+        for (size_t i = 0; i < nold; i++) {
+            if (old[i].first)
+                *section_slot(doc, old[i].first->name, old[i].hash) = old[i];
+        }
+        free(old);
+    }
 
-    for (struct section *s = sections; s; s = s->next) {
-        if (streq(s->name, name) && i-- == 0)
-            return s;
+    // append so sections are in config order
+    if (doc->last_section)
+        doc->last_section->next = s;
+    else
+        doc->sections = s;
+    doc->last_section = s;
+
+    size_t hash = hash_name(s->name);
+    struct section_slot *slot = section_slot(doc, s->name, hash);
+
+    s->hash = hash;
+    s->same = NULL;
+    if (slot->first) {
+        s->nth = slot->last->nth + 1;
+        slot->last->same = s;
+        slot->last = s;
+    } else {
+        s->nth = 0;
+        slot->hash = hash;
+        slot->first = slot->last = s;
+        doc->nnames++;
     }
 
-    return NULL;
+    return 0;
 }
 
-static void
+/* Return the last section named name, or NULL if there is none. */
+static struct section *
+find_last_section(const struct document *doc, const char *name)
+{
+    if (!doc->slots)
+        return NULL;
+    return section_slot(doc, name, hash_name(name))->last;
+}
+
+static struct section *
+find_section(const struct document *doc, const char *name, unsigned int i)
+{
+    struct section *s;
+
+    if (!doc->slots)
+        return NULL;
+
+    s = section_slot(doc, name, hash_name(name))->first;
+    for (; s && i > 0; i--)
+        s = s->same;
+
+    return s;
+}
+
+static struct section *
+get_section(const struct document *doc, const char *name, unsigned int i)
+{
+    // keys with no section are stored under "" section in inih
+    if (streq(name, NO_SECTION))
+        name = "";
+
+    struct section *s = find_section(doc, name, i);
+
+    PROBE3(query__section, name, i, s != NULL);
+    return s;
+}
+
+/* Copy str to name as part of a shell variable name, with characters not
+   allowed in names replaced by '_', and return the end of name. */
+static char *
+copy_name(char *name, const char *str)
+{
+    for (; *str; str++)
+        *name++ = isalnum((unsigned char)*str) ? *str : '_';
+    return name;
+}
+
+/* Add an assignment of p's value to a variable named after the prefix, the
+   section if given, and the key. */
+static void
+add_export(const char *section, const struct pair *p)
+{
+    const char *first = *export_prefix ? export_prefix :
+        section && *section ? section : p->key;
+    char *name = xmalloc(strlen(export_prefix) + (section ? strlen(section) : 0)
+            + p->key_len + 3);
+    char *end = name;
+
+    // names can't start with a digit
+    if (isdigit((unsigned char)*first))
+        *end++ = '_';
+    end = copy_name(end, export_prefix);
+    if (section && *section) {
+        end = copy_name(end, section);
+        *end++ = '_';
+    }
+    end = copy_name(end, p->key);
+    *end = '\0';
+
+    exports = xrealloc(exports, sizeof(struct export) * (nexports + 1));
+    exports[nexports++] = (struct export){name, section, p};
+}
+
+static int
+cmp_export(const void *a, const void *b)
+{
+    const struct export *const *x = a;
+    const struct export *const *y = b;
+
+    return strcmp((*x)->name, (*y)->name);
+}
+
+/* Print the path of an exported key for an error message. */
+static void
+print_export_path(const struct export *e)
+{
+    if (quiet)
+        return;
+    putc('\'', stderr);
+    if (e->section && *e->section)
+        fprintf(stderr, "%s%s", e->section, path_sep);
+    fputs(e->p->key, stderr);
+    putc('\'', stderr);
+}
+
+/* Print the assignments added, each value single-quoted so that eval takes
+   it verbatim. Names that are empty, or that two keys map to, are an error
+   rather than an assignment eval would drop or take the last of. */
+static void
+print_exports(void)
+{
+    struct export **sorted = xmalloc(sizeof(*sorted) * (nexports + 1));
+
+    for (size_t i = 0; i < nexports; i++) {
+        if (!*exports[i].name)
+            die("key '' has no variable name to export to\n");
+        sorted[i] = &exports[i];
+    }
+    qsort(sorted, nexports, sizeof(*sorted), cmp_export);
+    for (size_t i = 1; i < nexports; i++) {
+        if (streq(sorted[i - 1]->name, sorted[i]->name)) {
+            const struct export *x = sorted[i - 1] < sorted[i] ?
+                sorted[i - 1] : sorted[i];
+            const struct export *y = x == sorted[i] ? sorted[i - 1] : sorted[i];
+
+            print_export_path(x);
+            if (!quiet)
+                fputs(" and ", stderr);
+            print_export_path(y);
+            die(" both export to %s\n", x->name);
+        }
+    }
+    free(sorted);
+
+    for (size_t i = 0; i < nexports; i++) {
+        printf("%s='", exports[i].name);
+        for (const char *v = exports[i].p->value; *v; v++) {
+            if (*v == '\'')
+                fputs("'\\''", stdout);
+            else
+                putchar(*v);
+        }
+        puts("'");
+    }
+}
+
+/* Export the first occurrence of each key in s and those it inherits from
+   DEFAULT section d, as print_pairs() prints them. Names include the section
+   name if section is set. */
+static int
+add_exports(struct section *s, struct section *d,
+        const struct pattern *filter, int section)
+{
+    const char *name = section ? s->name : NULL;
+    int n = 0;
+
+    if (d && d != s) {
+        for (struct pair *dp = d->pairs; dp; dp = dp->next) {
+            if (find_pair(d, dp->key, dp->hash) != dp ||
+                    find_pair(s, dp->key, dp->hash))
+                continue;
+            if (filter && !pattern_match(filter, dp->key))
+                continue;
+            add_export(name, dp);
+            n++;
+        }
+    }
+
+    for (struct pair *p = s->pairs; p; p = p->next) {
+        // later occurrences never override the first one
+        if (find_pair(s, p->key, p->hash) != p)
+            continue;
+        if (filter && !pattern_match(filter, p->key))
+            continue;
+        add_export(name, p);
+        n++;
+    }
+
+    return n;
+}
+
+/* Export the keys of every section, or those whose names match names, with
+   the section in each variable name. Only the first section with a given
+   name is exported, as it's the one a path selects. */
+static int
+add_export_sections(const struct document *doc, const struct pattern *names,
+        const struct pattern *keys, struct section *d)
+{
+    int n = 0;
+
+    for (struct section *s = doc->sections; s; s = s->next) {
+        if (!include_default && streq(s->name, DEFAULT_SECTION))
+            continue;
+        if (names && !section_match(names, s->name))
+            continue;
+        if (s->nth > 0)
+            continue;
+        // only real sections inherit DEFAULT section
+        n += add_exports(s, *s->name ? d : NULL, keys, 1);
+    }
+
+    return n;
+}
+
+static void
+pair_table_init(struct pair_table *t, const struct section *s)
+{
+    size_t n = 8;
+
+    while (s && n < s->npairs * 2)
+        n *= 2;
+    t->mask = n - 1;
+    t->slots = xmalloc(sizeof(struct pair *) * n);
+    memset(t->slots, 0, sizeof(struct pair *) * n);
+
+    for (struct pair *p = s ? s->pairs : NULL; p; p = p->next) {
+        size_t i = hash_name(p->key) & t->mask;
+
+        while (t->slots[i] && !streq(t->slots[i]->key, p->key))
+            i = (i + 1) & t->mask;
+        if (!t->slots[i])
+            t->slots[i] = p;
+    }
+}
+
+static const struct pair *
+pair_table_find(const struct pair_table *t, const char *key)
+{
+    size_t i = hash_name(key) & t->mask;
+
+    for (; t->slots[i]; i = (i + 1) & t->mask) {
+        if (streq(t->slots[i]->key, key))
+            return t->slots[i];
+    }
+
+    return NULL;
+}
+
+/* Return the pair of key in side, inheriting from DEFAULT. */
+static const struct pair *
+diff_find(const struct diff_side *side, const char *key)
+{
+    const struct pair *p = pair_table_find(&side->own, key);
+
+    if (!p && side->defaults)
+        p = pair_table_find(side->defaults, key);
+    return p;
+}
+
+/* Print str with backslashes, tabs and newlines escaped, then sep. */
+static void
+print_diff_field(const char *str, int sep)
+{
+    for (; str && *str; str++) {
+        if (*str == '\\')
+            fputs("\\\\", stdout);
+        else if (*str == '\t')
+            fputs("\\t", stdout);
+        else if (*str == '\n')
+            fputs("\\n", stdout);
+        else
+            putchar(*str);
+    }
+    putchar(sep);
+}
+
+static void
+print_change(const char *change, const struct section *s, const char *key,
+        const char *old, const char *new)
+{
+    printf("%s\t", change);
+    print_diff_field(s->name, '\t');
+    printf("%u\t", s->nth);
+    print_diff_field(key, '\t');
+    print_diff_field(old, '\t');
+    print_diff_field(new, '\n');
+}
+
+/* Compare each key of x, in the order print_pairs() prints them, to the same
+   key in y, and print the changes under section at: keys missing from y are
+   removed from x, or added to y if added is set, and with added unset, keys
+   whose values differ are changed. Return the number of changes. */
+static int
+diff_keys(const struct diff_side *x, const struct diff_side *y,
+        const struct section *d, const struct section *at, int added)
+{
+    const struct pair *keys[2] = {NULL, x->s ? x->s->pairs : NULL};
+    int n = 0;
+
+    // keys inherited from DEFAULT come first
+    if (x->defaults)
+        keys[0] = d->pairs;
+
+    for (int k = 0; k < 2; k++) {
+        for (const struct pair *p = keys[k]; p; p = p->next) {
+            // only the first occurrence of a key is ever looked up
+            if (diff_find(x, p->key) != p)
+                continue;
+
+            const struct pair *q = diff_find(y, p->key);
+
+            if (added && !q)
+                print_change("added", at, p->key, NULL, p->value);
+            else if (!added && !q)
+                print_change("removed", at, p->key, p->value, NULL);
+            else if (!added && !streq(p->value, q->value))
+                print_change("changed", at, p->key, p->value, q->value);
+            else
+                continue;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/* Print the changes from section sa, inheriting from DEFAULT section da, to
+   section sb, inheriting from db. Either section may be missing, which is
+   itself a change if sections is set. */
+static int
+diff_section(const struct section *sa, const struct section *sb,
+        const struct section *da, const struct pair_table *dta,
+        const struct section *db, const struct pair_table *dtb, int sections)
+{
+    const struct section *name = sa ? sa : sb;
+    // only real sections inherit DEFAULT section
+    int real = *name->name && !streq(name->name, DEFAULT_SECTION);
+    struct diff_side a = {sa, {NULL, 0}, real && sa && da ? dta : NULL};
+    struct diff_side b = {sb, {NULL, 0}, real && sb && db ? dtb : NULL};
+    int n = 0;
+
+    if (sections && (!sa || !sb)) {
+        print_change(sa ? "removed" : "added", name, NULL, NULL, NULL);
+        n++;
+    }
+
+    pair_table_init(&a.own, sa);
+    pair_table_init(&b.own, sb);
+    n += diff_keys(&a, &b, da, name, 0);
+    n += diff_keys(&b, &a, db, name, 1);
+    free(a.own.slots);
+    free(b.own.slots);
+
+    return n;
+}
+
+/* Print the changes from document a to document b, matching the nth section
+   of a name in a with the nth of that name in b. Sections only in one of them
+   are reported as such if sections is set. Return the number of changes. */
+static int
+print_diff(const struct document *a, const struct document *b, int sections)
+{
+    const struct section *da = find_section(a, DEFAULT_SECTION, 0);
+    const struct section *db = find_section(b, DEFAULT_SECTION, 0);
+    struct pair_table dta, dtb;
+    int n = 0;
+
+    pair_table_init(&dta, da);
+    pair_table_init(&dtb, db);
+
+    for (const struct section *s = a->sections; s; s = s->next) {
+        if (!include_default && streq(s->name, DEFAULT_SECTION))
+            continue;
+        n += diff_section(s, find_section(b, s->name, s->nth), da, &dta, db,
+                &dtb, sections);
+    }
+    for (const struct section *s = b->sections; s; s = s->next) {
+        if (!include_default && streq(s->name, DEFAULT_SECTION))
+            continue;
+        if (!find_section(a, s->name, s->nth))
+            n += diff_section(NULL, s, da, &dta, db, &dtb, sections);
+    }
+
+    free(dta.slots);
+    free(dtb.slots);
+
+    return n;
+}
+
+/* Return the section that pairs of section are added to, starting a new one
+   for a [section] header unless sections of that name are combined, or NULL
+   if they are not wanted or doc failed to allocate one. */
+static struct section *
+open_section(struct document *doc, const char *section, int header)
+{
+    const struct query *q = doc->query;
+    int default_section = streq(section, DEFAULT_SECTION);
+    struct section *s = NULL;
+
+    if (disable_default && default_section)
+        return NULL;
+
+    if (!wanted_section(q, section, default_section))
+        return NULL;
+
+    s = find_last_section(doc, section);
+
+    if (!s || (header && !(default_section || combine_sections))) {
+        STAT(stats.duplicates += s != NULL);
+        if (!(s = try_malloc(sizeof(struct section)))) {
+            doc->failed = 1;
+            return NULL;
+        }
+        s->name_len = str_info(section, &s->name_flags);
+        s->name = try_memdup(section, s->name_len);
+        s->pairs = NULL;
+        s->last = NULL;
+        s->index = NULL;
+        s->nindex = 0;
+        s->npairs = 0;
+        s->lookups = 0;
+        s->bloom = NULL;
+        s->next = NULL;
+
+        if (!s->name || append_section(doc, s) < 0) {
+            free((void *)s->name);
+            free(s);
+            doc->failed = 1;
+            return NULL;
+        }
+        PROBE2(section__new, s->name, s->nth);
+    }
+
+    return s;
+}
+
+/* Add a pair to s if its key is wanted. key is null-terminated, value is
+   value_len bytes. Returns the pair, or NULL if it was discarded or doc failed
+   to allocate it. */
+static struct pair *
+store_pair(struct document *doc, struct section *s, const char *key,
+        size_t key_len, const char *value, size_t value_len)
+{
+    const struct query *q = doc->query;
+
+    if (!wanted_key(q, key))
+        return NULL;
+
+    STAT(stats.stored_pairs++);
+
+    struct pair *p = try_malloc(sizeof(struct pair));
+
+    if (!p || !(p->value = try_memdup(value, value_len))) {
+        free(p);
+        doc->failed = 1;
+        return NULL;
+    }
+    if (!(p->key = try_memdup(key, key_len))) {
+        free((void *)p->value);
+        free(p);
+        doc->failed = 1;
+        return NULL;
+    }
+    p->key_len = key_len;
+    str_info(key, &p->key_flags);
+    p->value_len = str_info(p->value, &p->value_flags);
+    p->hash = hash_name(p->key);
+    p->next = NULL;
+
+    append_pair(s, p);
+
+    // a stale index or filter would miss the new pair
+    if (s->index) {
+        free(s->index);
+        s->index = NULL;
+    }
+    s->bloom = NULL;
+
+    if (q->first_only && s == find_section(doc, q->section->alts[0], q->index))
+        doc->done = 1;
+
+    return p;
+}
+
+static int
+handler(void *user, const char *section, const char *key, const char *value)
+{
+    struct document *doc = user;
+    struct section *s;
+
+    STAT(key ? stats.pairs++ : stats.sections++);
+
+    // the section still exists if its pairs are discarded
+    if ((s = open_section(doc, section, !key)) && key)
+        store_pair(doc, s, key, strlen(key), value, strlen(value));
+    return !doc->failed;
+}
+
+/* Append len bytes of str to the value of p, joined by join. *size is the
+   size of the value's buffer, which doubles as needed. Returns -1 if it
+   can't grow, leaving the value as it was. */
+static int
+extend_value(struct pair *p, size_t *size, char join, const char *str,
+        size_t len)
+{
+    size_t need = p->value_len + len + 2;
+    char *value = (char *)p->value;
+
+    if (need > *size) {
+        if (*size < p->value_len + 1)
+            *size = p->value_len + 1;
+        while (*size < need)
+            *size *= 2;
+        if (!(value = try_realloc(value, *size)))
+            return -1;
+        p->value = value;
+    }
+
+    value[p->value_len++] = join;
+    memcpy(value + p->value_len, str, len);
+    p->value_len += len;
+    value[p->value_len] = '\0';
+    return 0;
+}
+
+/* Build doc from the events pulled from r. Unlike the handler, pairs are
+   added to the section opened by the last header without looking it up
+   again, and keys are only copied out of the input in wanted sections.
+   Returns 0, the line number of the first error, or -1 if reading or
+   allocating failed. */
+static int
+parse_events(ini_reader_state *r, struct document *doc)
+{
+    const struct query *q = doc->query;
+    struct section *s = NULL;
+    struct pair *p = NULL;
+    char *key = NULL;
+    size_t key_size = 0;
+    size_t size = 0;
+    int opened = 0;
+    int err = 0;
+    int ret = 0;
+    ini_event ev;
+
+    while (!doc->failed && (ret = ini_reader_next(r, &ev)) > 0) {
+        if (ev.type == INI_EVENT_CONTINUATION) {
+            if (p && extend_value(p, &size, r->c.join, ev.value.ptr,
+                        ev.value.len) < 0)
+                doc->failed = 1;
+            continue;
+        }
+
+        // a line that can't be parsed doesn't end a multi-line value
+        if (ev.type == INI_EVENT_ERROR) {
+            if (!err)
+                err = ev.lineno;
+            continue;
+        }
+
+        // a value's flags are only known once its last line is read
+        if (p && size)
+            p->value_len = str_info(p->value, &p->value_flags);
+        p = NULL;
+        size = 0;
+
+        // later lines can't change the answer to the query
+        if (doc->done)
+            break;
+
+        switch (ev.type) {
+        case INI_EVENT_SECTION:
+            STAT(stats.sections++);
+            s = open_section(doc, ev.section, 1);
+            opened = 1;
+            break;
+        case INI_EVENT_PAIR:
+            STAT(stats.pairs++);
+            // pairs before any header are in the "" section
+            if (!opened) {
+                s = open_section(doc, ev.section, 0);
+                opened = 1;
+            }
+            if (s && !q->no_pairs) {
+                if (ev.name.len >= key_size) {
+                    char *k = try_realloc(key, ev.name.len + 1);
+
+                    if (!k) {
+                        doc->failed = 1;
+                        break;
+                    }
+                    key = k;
+                    key_size = ev.name.len + 1;
+                }
+                memcpy(key, ev.name.ptr, ev.name.len);
+                key[ev.name.len] = '\0';
+                p = store_pair(doc, s, key, ev.name.len, ev.value.ptr,
+                        ev.value.len);
+            }
+            break;
+        }
+    }
+
+    if (p && size)
+        p->value_len = str_info(p->value, &p->value_flags);
+    free(key);
+
+    return ret < 0 || doc->failed ? -1 : err;
+}
+
+static void
+merge_section(struct section *t, struct section *s)
+{
+    struct pair *dead = NULL;
+    struct pair *next;
+
+    // index both sides before pairs are moved between their lists
+    if (t->npairs >= INDEX_MIN_PAIRS && !t->index)
+        build_index(t);
+    if (s->pairs && !s->index)
+        build_index(s);
+
+    for (struct pair *p = s->pairs; p; p = next) {
+        struct pair *old = NULL;
+
+        next = p->next;
+        p->next = NULL;
+
+        // only the first occurrence of a key overrides the lower layer
+        if (find_pair(s, p->key, p->hash) == p)
+            old = find_pair(t, p->key, p->hash);
+
+        if (old) {
+            free((void *)old->value);
+            old->value = p->value;
+            old->value_len = p->value_len;
+            old->value_flags = p->value_flags;
+            // the index of s still points at p until the loop is done
+            p->next = dead;
+            dead = p;
+        } else {
+            append_pair(t, p);
+        }
+    }
+
+    for (struct pair *p = dead; p; p = next) {
+        next = p->next;
+        free((void *)p->key);
+        free(p);
+    }
+
+    s->pairs = s->last = NULL;
+    s->npairs = 0;
+    free(t->index);
+    t->index = NULL;
+}
+
+/* Merge layer into base: the nth section with a given name in layer is merged
+   into the nth section with that name in base, and keys in layer replace
+   those in base. Layer is left empty. */
+static void
+merge_layer(struct document *base, struct document *layer)
+{
+    struct section **targets;
+    struct section *next;
+    size_t n = 0;
+
+    for (struct section *s = layer->sections; s; s = s->next)
+        n++;
+    targets = xmalloc(sizeof(struct section *) * (n ? n : 1));
+
+    // find targets first, as merged sections are freed below
+    n = 0;
+    for (struct section *s = layer->sections; s; s = s->next)
+        targets[n++] = find_section(base, s->name, s->nth);
+
+    n = 0;
+    for (struct section *s = layer->sections; s; s = next) {
+        struct section *t = targets[n++];
+
+        next = s->next;
+        if (t) {
+            merge_section(t, s);
+            free_section(s);
+        } else {
+            s->next = NULL;
+            append_section(base, s);
+        }
+    }
+
+    free(targets);
+    layer->sections = layer->last_section = NULL;
+    free(layer->slots);
+    layer->slots = NULL;
+    layer->nslots = layer->nnames = 0;
+}
+
+#if INIQ_STATS
+/* Count a chunk of a line read into str, the last one if eof is set. */
+static void
+stats_count(const char *str, int eof)
+{
+    size_t len = strlen(str);
+
+    stats.bytes += len;
+    stats.line_len += len;
+    // long lines are read in several chunks
+    if ((len > 0 && str[len - 1] == '\n') || eof) {
+        stats.lines++;
+        if (stats.line_len > stats.max_line)
+            stats.max_line = stats.line_len;
+        stats.line_len = 0;
+    }
+}
+
+static char *
+stats_reader(char *str, int num, void *stream)
+{
+    if (!fgets(str, num, stream))
+        return NULL;
+    stats_count(str, feof(stream));
+    return str;
+}
+
+static void
+stats_mark(struct timespec *ts)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static double
+stats_elapsed(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void
+print_stats(void)
+{
+    struct timespec end;
+    struct rusage ru;
+
+    fflush(stdout);
+    stats_mark(&end);
+    getrusage(RUSAGE_SELF, &ru);
+
+    // phases that were never reached take no time
+    if (!stats.parsed.tv_sec && !stats.parsed.tv_nsec)
+        stats.parsed = end;
+    if (!stats.queried.tv_sec && !stats.queried.tv_nsec)
+        stats.queried = end;
+
+    const char *fmt = stats.json
+        ? "{\"bytes\":%zu,\"lines\":%zu,\"max_line\":%zu,"
+          "\"sections\":%zu,\"duplicate_sections\":%zu,\"pairs\":%zu,"
+          "\"stored_pairs\":%zu,\"bloom_rejects\":%zu,\"allocs\":%zu,"
+          "\"alloc_bytes\":%zu,"
+          "\"parse_time\":%.9f,\"query_time\":%.9f,\"output_time\":%.9f,"
+          "\"peak_rss_kb\":%ld}\n"
+        : "bytes: %zu\n"
+          "lines: %zu\n"
+          "max line: %zu\n"
+          "sections: %zu\n"
+          "duplicate sections: %zu\n"
+          "pairs: %zu\n"
+          "stored pairs: %zu\n"
+          "bloom rejects: %zu\n"
+          "allocs: %zu\n"
+          "alloc bytes: %zu\n"
+          "parse time: %.9f\n"
+          "query time: %.9f\n"
+          "output time: %.9f\n"
+          "peak rss kb: %ld\n";
+
+    fprintf(stderr, fmt, stats.bytes, stats.lines, stats.max_line,
+            stats.sections, stats.duplicates, stats.pairs, stats.stored_pairs,
+            stats.bloom_rejects, stats.allocs, stats.alloc_bytes,
+            stats_elapsed(&stats.start, &stats.parsed),
+            stats_elapsed(&stats.parsed, &stats.queried),
+            stats_elapsed(&stats.queried, &end), ru.ru_maxrss);
+}
+#endif /* INIQ_STATS */
+
+/* Size of the chunks that section headers are scanned in when the input
+   isn't a file that can be mapped. */
+#define SCAN_CHUNK_SIZE 65536
+
+/* fread() for scan_chunks(). */
+static size_t
+file_read(char *buf, size_t size, void *stream)
+{
+    return fread(buf, 1, size, stream);
+}
+
+/* Scan input for section headers a chunk at a time, keeping only the
+   partial line at the end of a chunk for the next. read fills buf like
+   fread(), returning 0 at the end of the input or on error. */
+static int
+scan_chunks(size_t (*read)(char *buf, size_t size, void *stream),
+        void *stream, ini_parser_config c, struct document *doc)
+{
+    char *buf = try_malloc(SCAN_CHUNK_SIZE);
+    ini_scan_state st;
+    size_t len = 0;
+    size_t n;
+
+    if (!buf)
+        return -1;
+    ini_scan_init(&st, c);
+
+    do {
+        // the partial line left is shorter than a line, so there is room
+        n = read(buf + len, SCAN_CHUNK_SIZE - len, stream);
+        STAT(stats.bytes += n);
+        len += n;
+
+        size_t done = ini_scan_chunk(&st, buf, len, n == 0, handler, doc);
+
+        memmove(buf, buf + done, len - done);
+        len -= done;
+    } while (n > 0 && !doc->failed);
+
+    free(buf);
+    return doc->failed ? -1 : st.error;
+}
+
+#if INIQ_ZLIB
+/* Size of the buffers of compressed and decompressed input of a gzip
+   stream, which bound the memory it takes whatever its size. */
+#define GZIP_BUF_SIZE 65536
+
+/* gzip-compressed input, decompressed a buffer at a time as the parser reads
+   lines from it. The compressed data is read from file or, if file is NULL,
+   is all in z.next_in. */
+struct gzip_stream {
+    z_stream z;
+    FILE *file;
+    unsigned char in[GZIP_BUF_SIZE];
+    char out[GZIP_BUF_SIZE];
+    size_t pos;
+    size_t len;
+    int end;
+    int err;
+};
+
+static int
+is_gzip(const char *buf, size_t len)
+{
+    return len >= 2 && buf[0] == '\x1f' && buf[1] == '\x8b';
+}
+
+/* Read more compressed data into g's input buffer, if it has a file, and
+   return whether there is any. */
+static int
+gzip_input(struct gzip_stream *g)
+{
+    if (g->z.avail_in || !g->file)
+        return g->z.avail_in > 0;
+
+    size_t n = fread(g->in, 1, GZIP_BUF_SIZE, g->file);
+
+    if (ferror(g->file))
+        g->err = 1;
+    g->z.next_in = g->in;
+    g->z.avail_in = n;
+    return n > 0;
+}
+
+/* Decompress the next buffer of g, and return its length, or 0 at the end of
+   the data or on error. */
+static size_t
+gzip_fill(struct gzip_stream *g)
+{
+    g->pos = g->len = 0;
+
+    while (!g->len && !g->end && !g->err) {
+        // data ending before the stream does is truncated
+        if (!gzip_input(g)) {
+            g->err = 1;
+            break;
+        }
+
+        g->z.next_out = (Bytef *)g->out;
+        g->z.avail_out = GZIP_BUF_SIZE;
+
+        int r = inflate(&g->z, Z_NO_FLUSH);
+
+        g->len = GZIP_BUF_SIZE - g->z.avail_out;
+        if (r == Z_STREAM_END) {
+            // gzip(1) may write several members one after another
+            if (gzip_input(g))
+                g->err = inflateReset(&g->z) != Z_OK;
+            else
+                g->end = 1;
+        } else if (r != Z_OK) {
+            g->err = 1;
+        }
+    }
+
+    return g->len;
+}
+
+/* Read a line from a gzip_stream like fgets(). */
+static char *
+gzip_reader(char *str, int num, void *stream)
+{
+    struct gzip_stream *g = stream;
+    size_t n = 0;
+
+    while (n + 1 < (size_t)num) {
+        if (g->pos == g->len && !gzip_fill(g))
+            break;
+
+        size_t avail = g->len - g->pos;
+        const char *start = g->out + g->pos;
+        const char *nl;
+
+        if (avail > num - 1 - n)
+            avail = num - 1 - n;
+        nl = memchr(start, '\n', avail);
+        if (nl)
+            avail = nl - start + 1;
+        memcpy(str + n, start, avail);
+        n += avail;
+        g->pos += avail;
+        if (nl)
+            break;
+    }
+
+    if (n == 0)
+        return NULL;
+    str[n] = '\0';
+#if INIQ_STATS
+    if (stats.enabled)
+        stats_count(str, g->end && g->pos == g->len);
+#endif /* INIQ_STATS */
+    return str;
+}
+
+/* Read decompressed data from g like fread(). */
+static size_t
+gzip_read(char *buf, size_t size, void *stream)
+{
+    struct gzip_stream *g = stream;
+    size_t n = 0;
+
+    while (n < size && (g->pos < g->len || gzip_fill(g))) {
+        size_t avail = g->len - g->pos;
+
+        if (avail > size - n)
+            avail = size - n;
+        memcpy(buf + n, g->out + g->pos, avail);
+        g->pos += avail;
+        n += avail;
+    }
+
+    return n;
+}
+
+/* Parse gzip-compressed data read from file, or the len bytes of buf if file
+   is NULL. */
+static int
+parse_gzip(FILE *file, const char *buf, size_t len, ini_parser_config c,
+        struct document *doc)
+{
+    struct gzip_stream *g = try_malloc(sizeof(struct gzip_stream));
+    ini_reader_state r;
+    int err = -1;
+
+    if (!g)
+        return -1;
+    memset(&g->z, 0, sizeof(g->z));
+    g->file = file;
+    g->z.next_in = (Bytef *)buf;
+    g->z.avail_in = file ? 0 : len;
+    g->pos = g->len = 0;
+    g->end = g->err = 0;
+
+    // 16 accepts only a gzip header and trailer around the deflate data
+    if (inflateInit2(&g->z, 16 + MAX_WBITS) != Z_OK) {
+        free(g);
+        return -1;
+    }
+
+    if (doc->query->headers_only) {
+        // scanning for headers is faster than reading lines, as for
+        // uncompressed input
+        err = scan_chunks(gzip_read, g, c, doc);
+    } else if (ini_reader_init_stream(&r, gzip_reader, g, c) == 0) {
+        err = parse_events(&r, doc);
+        ini_reader_free(&r);
+    }
+    if (g->err || doc->failed)
+        err = -1;
+
+    inflateEnd(&g->z);
+    free(g);
+    return err;
+}
+#endif /* INIQ_ZLIB */
+
+static int
+parse_buffer(const char *buf, size_t len, ini_parser_config c,
+        struct document *doc)
+{
+    ini_reader_state r;
+
+#if INIQ_ZLIB
+    if (is_gzip(buf, len))
+        return parse_gzip(NULL, buf, len, c, doc);
+#endif /* INIQ_ZLIB */
+
+    if (doc->query->headers_only) {
+        int err = ini_scan_sections(buf, len, handler, c, doc);
+
+        return doc->failed ? -1 : err;
+    }
+
+    ini_reader_init_buffer(&r, buf, len, c);
+
+    int err = parse_events(&r, doc);
+
+    ini_reader_free(&r);
+    return err;
+}
+
+static int
+parse_file(FILE *file, ini_parser_config c, struct document *doc)
+{
+#if INIQ_ZLIB
+    // no text file starts with the first byte of the gzip magic number, and
+    // one byte is all that can be pushed back
+    int first = getc(file);
+
+    if (first != EOF && ungetc(first, file) == EOF)
+        return -1;
+    if (first == 0x1f)
+        return parse_gzip(file, NULL, 0, c, doc);
+#endif /* INIQ_ZLIB */
+
+    if (doc->query->headers_only) {
+        struct stat st;
+        off_t off = ftello(file);
+
+        // a file is mapped and scanned in one go, from where reading it
+        // would start
+        if (off >= 0 && fstat(fileno(file), &st) == 0 &&
+                S_ISREG(st.st_mode) && st.st_size > off) {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                    fileno(file), 0);
+
+            if (map != MAP_FAILED) {
+                STAT(stats.bytes += st.st_size - off);
+
+                int err = parse_buffer((char *)map + off, st.st_size - off, c,
+                        doc);
+
+                munmap(map, st.st_size);
+                return err;
+            }
+        }
+
+        int err = scan_chunks(file_read, file, c, doc);
+
+        return ferror(file) ? -1 : err;
+    }
+
+    ini_reader reader = (ini_reader)fgets;
+    ini_reader_state r;
+
+#if INIQ_STATS
+    if (stats.enabled)
+        reader = stats_reader;
+#endif /* INIQ_STATS */
+    if (ini_reader_init_stream(&r, reader, file, c) < 0)
+        return -1;
+
+    int err = parse_events(&r, doc);
+
+    ini_reader_free(&r);
+    return err;
+}
+
+static int
+parse_layer(size_t i, ini_parser_config c)
+{
+    // a NULL file is standard input
+    FILE *f = files[i] ? fopen(files[i], "r") : stdin;
+    int err = -1;
+
+    PROBE2(parse__start, files[i] ? files[i] : "-", i);
+    if (f)
+        err = parse_file(f, c, &layers[i]);
+    PROBE3(parse__done, files[i] ? files[i] : "-", f ? (long)ftell(f) : -1L,
+            err);
+
+    if (f && f != stdin)
+        fclose(f);
+
+    return err;
+}
+
+static void *
+parse_layer_jobs(void *arg)
+{
+    struct layer_jobs *jobs = arg;
+
+    // errors are left for the main thread to report, as die() would exit
+    // while other threads are still parsing
+    for (;;) {
+        pthread_mutex_lock(&jobs->lock);
+        size_t i = jobs->next++;
+        pthread_mutex_unlock(&jobs->lock);
+
+        if (i >= nfiles)
+            break;
+
+        // files already read in a batch are parsed from their buffers
+        int err;
+        const struct file_buf *b = jobs->bufs ? &jobs->bufs[i] : NULL;
+
+        if (b && files[i]) {
+            PROBE2(parse__start, files[i], i);
+            err = b->data ? parse_buffer(b->data, b->len, jobs->c, &layers[i])
+                          : -1;
+            PROBE3(parse__done, files[i], (long)b->len, err);
+        } else {
+            err = parse_layer(i, jobs->c);
+        }
+
+        jobs->errs[i] = err < 0;
+    }
+
+    return NULL;
+}
+
+static void
+parse_layers(ini_parser_config c, int merge)
+{
+    struct layer_jobs jobs = {
+        .c = c,
+        .bufs = NULL,
+        .next = 0,
+        .errs = xmalloc(sizeof(int) * nfiles),
+    };
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = ncpu > 0 && (size_t)ncpu < nfiles ? (size_t)ncpu : nfiles;
+    // reading every file up front batches the system calls, which matters
+    // more than overlapping reads with parsing for many small files
+    int batch = nfiles > 1;
+
+#if INIQ_STATS
+    // counters are not shared safely between threads, and lines are only
+    // counted when read through stats_reader
+    if (stats.enabled) {
+        nthreads = 1;
+        batch = 0;
+    }
+#endif /* INIQ_STATS */
+
+    if (batch) {
+        jobs.bufs = xmalloc(sizeof(struct file_buf) * nfiles);
+        read_files(files, nfiles, jobs.bufs);
+    }
+
+    // the job loop takes the lock even when it runs on this thread alone
+    pthread_mutex_init(&jobs.lock, NULL);
+    if (nthreads <= 1) {
+        parse_layer_jobs(&jobs);
+    } else {
+        pthread_t *threads = xmalloc(sizeof(pthread_t) * nthreads);
+
+        for (size_t i = 0; i < nthreads; i++) {
+            if (pthread_create(&threads[i], NULL, parse_layer_jobs, &jobs))
+                die("failed to create thread\n");
+        }
+        for (size_t i = 0; i < nthreads; i++)
+            pthread_join(threads[i], NULL);
+        free(threads);
+    }
+    pthread_mutex_destroy(&jobs.lock);
+
+    if (jobs.bufs) {
+        for (size_t i = 0; i < nfiles; i++)
+            free(jobs.bufs[i].data);
+        free(jobs.bufs);
+    }
+
+    for (size_t i = 0; i < nfiles; i++) {
+        if (jobs.errs[i]) {
+            free(jobs.errs);
+            die("failed to parse %s\n", files[i] ? files[i] : "stdin");
+        }
+    }
+    free(jobs.errs);
+
+    // later layers take precedence
+    for (size_t i = 1; merge && i < nfiles; i++)
+        merge_layer(&layers[0], &layers[i]);
+}
+
+/* Look up key in the layers from the top down, parsing each only when the
+   ones above it don't have the key. DEFAULT is only consulted once no layer
+   has the key in the section itself. */
+static int
+print_layered_value(const char *fmt, const char *name, unsigned int index,
+        const char *key, ini_parser_config c, int *found)
+{
+    struct section *s;
+
+    for (size_t i = nfiles; i-- > 0;) {
+        if (parse_layer(i, c) < 0)
+            die("failed to parse %s\n", files[i]);
+        if ((s = get_section(&layers[i], name, index))) {
+            *found = 1;
+            if (print_value(fmt, s, key))
+                return 1;
+        }
+    }
+
+    if (!*found || disable_default)
+        return 0;
+
+    for (size_t i = nfiles; i-- > 0;) {
+        s = get_section(&layers[i], DEFAULT_SECTION, 0);
+        if (s && print_value(fmt, s, key))
+            return 1;
+    }
+
+    return 0;
+}
+
+static void
+push_edit(const char *arg, int set)
+{
+    edits = xrealloc(edits, sizeof(struct edit) * (nedits + 1));
+    edits[nedits++] = (struct edit){.arg = arg, .value = set ? "" : NULL};
+}
+
+/* Return nonzero if str, of len bytes, parses back as itself: it doesn't
+   start or end with whitespace, start with one of starts, or hold a newline,
+   one of stops or an inline comment. */
+static int
+parses_back(const char *str, size_t len, const char *starts, const char *stops)
+{
+    if (len > 0 && (isspace((unsigned char)str[0]) ||
+                isspace((unsigned char)str[len - 1]) || strchr(starts, str[0])))
+        return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] == '\n' || strchr(stops, str[i]))
+            return 0;
+#if INI_ALLOW_INLINE_COMMENTS
+        if (i > 0 && isspace((unsigned char)str[i - 1]) &&
+                strchr(INI_INLINE_COMMENT_PREFIXES, str[i]))
+            return 0;
+#endif
+    }
+    return 1;
+}
+
+/* Split each edit's argument into its section, key and value. The path is
+   split at its last separator, as keys rarely contain one but sections
+   such as example.com do. Names and values that would read back as
+   something else, or not fit on a line, are rejected. */
+static void
+split_edits(const char *seps, unsigned int index)
+{
+    for (size_t i = 0; i < nedits; i++) {
+        struct edit *e = &edits[i];
+        const char *eq = e->value ? strchr(e->arg, '=') : NULL;
+        const char *end = eq ? eq : e->arg + strlen(e->arg);
+        const char *sep = NULL;
+
+        if (e->value && !eq)
+            die("invalid --set argument: %s\n", e->arg);
+        for (const char *c = e->arg; c < end; c++) {
+            if (*c == *path_sep)
+                sep = c;
+        }
+        if (!sep || sep + 1 == end)
+            die("invalid path: %.*s\n", (int)(end - e->arg), e->arg);
+
+        // there is only one sectionless part
+        if (sep == e->arg && index > 0)
+            die("invalid index for path: %.*s\n", (int)(end - e->arg), e->arg);
+
+        e->section = xmemdup(e->arg, sep - e->arg);
+        e->key_len = end - sep - 1;
+        e->key = xmemdup(sep + 1, e->key_len);
+        if (sep - e->arg >= INI_MAX_SECTION ||
+                !parses_back(e->section, sep - e->arg, "", "]"))
+            die("invalid section: %s\n", e->section);
+        if (!parses_back(e->key, e->key_len, INI_START_COMMENT_PREFIXES "[",
+                    seps ? seps : "=:"))
+            die("invalid key: %s\n", e->key);
+        if (eq) {
+            size_t len = strlen(eq + 1);
+
+            e->value = eq + 1;
+            if (!parses_back(e->value, len, VALUE_START_COMMENTS, ""))
+                die("invalid value: %s\n", e->value);
+            // the line is key, separator, value and newline
+            if (e->key_len + len + 2 > INI_MAX_LINE - 1)
+                die("value too long: %s\n", e->value);
+        }
+    }
+
+    // a later edit of the same key wins
+    for (size_t i = 0; i < nedits; i++) {
+        for (size_t j = i + 1; j < nedits && !edits[i].overridden; j++) {
+            edits[i].overridden = streq(edits[i].section, edits[j].section) &&
+                streq(edits[i].key, edits[j].key);
+        }
+    }
+}
+
+/* Read a line like fgets() from the input of an edit, holding on to a copy
+   of it. */
+static char *
+edit_reader(char *str, int num, void *stream)
+{
+    struct edit_input *in = stream;
+    size_t n = 0;
+
+    if (in->file) {
+        int ch = 0;
+
+        while (n < (size_t)num - 1 && ch != '\n' &&
+                (ch = getc_unlocked(in->file)) != EOF)
+            str[n++] = ch;
+        if (ferror(in->file))
+            die("failed to read input\n");
+    } else {
+        const char *nl;
+
+        n = in->end - in->buf;
+        if (n > (size_t)num - 1)
+            n = num - 1;
+        if ((nl = memchr(in->buf, '\n', n)))
+            n = nl + 1 - in->buf;
+        memcpy(str, in->buf, n);
+        in->buf += n;
+    }
+    if (n == 0)
+        return NULL;
+    str[n] = '\0';
+
+    if (in->pos == 0 && n >= 3 && !memcmp(str, "\xEF\xBB\xBF", 3))
+        in->start = 3;
+    if (in->file) {
+        if (in->pos - in->base + n > in->size) {
+            in->size = (in->pos - in->base + n) * 2;
+            in->held = xrealloc(in->held, in->size);
+        }
+        memcpy(in->held + (in->pos - in->base), str, n);
+    }
+    in->line = in->pos;
+    in->pos += n;
+    in->str = str;
+    in->last = str[n - 1];
+    return str;
+}
+
+/* Return the offset in the input of ptr, which points into the last line
+   read. */
+static size_t
+input_offset(const struct edit_input *in, const char *ptr)
+{
+    return in->line + (ptr - in->str);
+}
+
+/* Write the input from base up to offset to, or drop it if out is NULL. */
+static void
+copy_to(struct edit_input *in, size_t to, FILE *out)
+{
+    if (to > in->base) {
+        const char *from = in->file ? in->held : in->data + in->base;
+
+        if (out)
+            fwrite(from, 1, to - in->base, out);
+        if (in->file)
+            memmove(in->held, in->held + (to - in->base), in->pos - to);
+        in->base = to;
+    }
+}
+
+/* Write the pending sets of the current section at insert, after the last
+   line of the section that holds a pair or its header, and return how many
+   were written. newline is set if that line lacks a newline at the end of
+   input. */
+static size_t
+insert_sets(struct edit_input *in, size_t insert, int newline, int sep,
+        FILE *out)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < nedits; i++) {
+        struct edit *e = &edits[i];
+
+        if (!e->active || !e->value || e->done || e->overridden)
+            continue;
+        copy_to(in, insert, out);
+        if (newline && n == 0)
+            putc('\n', out);
+        fprintf(out, "%s%c%s\n", e->key, sep, e->value);
+        e->done = 1;
+        n++;
+    }
+    return n;
+}
+
+/* Apply the edits to the INI data read from in, writing the result to out.
+   Only the lines of keys that are set or deleted are rewritten, and
+   everything else is copied verbatim. Input is written once it is past the
+   point where pending sets would go, so only the lines since the last pair
+   are held. Sets and deletes apply to the index'th section of their name. */
+static void
+apply_edits(struct edit_input *in, ini_parser_config c, unsigned int index,
+        FILE *out)
+{
+    int sep = c.seps && *c.seps ? *c.seps : '=';
+    // new keys outside any section go first, after a byte order mark
+    size_t insert = 0;
+    // lines of a replaced or deleted value are dropped up to the next pair
+    int dropping = 0;
+    ini_reader_state r;
+    ini_event ev;
+    int ret;
+
+    for (size_t i = 0; i < nedits; i++)
+        edits[i].active = !*edits[i].section && index == 0;
+
+    if (ini_reader_init_stream(&r, edit_reader, in, c) < 0)
+        die("failed to allocate memory\n");
+    while ((ret = ini_reader_next(&r, &ev)) > 0) {
+        // the event's line is the last one read
+        size_t line = in->line;
+        size_t line_end = in->pos;
+
+        if (!insert)
+            insert = in->start;
+        // nothing is inserted before the insertion point
+        copy_to(in, insert, out);
+
+        if (ev.type == INI_EVENT_CONTINUATION) {
+            if (dropping) {
+                copy_to(in, line, out);
+                copy_to(in, line_end, NULL);
+            } else {
+                insert = line_end;
+            }
+            continue;
+        }
+        if (ev.type == INI_EVENT_ERROR)
+            continue;
+        dropping = 0;
+
+        if (ev.type == INI_EVENT_SECTION) {
+            insert_sets(in, insert, 0, sep, out);
+            for (size_t i = 0; i < nedits; i++) {
+                struct edit *e = &edits[i];
+                e->active = streq(e->section, ev.section) && e->seen++ == index;
+            }
+            insert = line_end;
+            continue;
+        }
+
+        insert = line_end;
+        for (size_t i = 0; i < nedits; i++) {
+            struct edit *e = &edits[i];
+
+            if (!e->active || e->overridden || e->key_len != ev.name.len ||
+                    memcmp(e->key, ev.name.ptr, ev.name.len))
+                continue;
+
+            if (!e->value || e->done) {
+                // a deleted key goes with all its lines, and so do later
+                // occurrences of a key that is set
+                if (!e->value) {
+                    copy_to(in, line, out);
+                    copy_to(in, line_end, NULL);
+                    dropping = 1;
+                }
+                break;
+            }
+
+            // replace only the value, keeping the key, separator and any
+            // comment as they are
+            size_t from = input_offset(in, ev.value.ptr ? ev.value.ptr :
+                    ev.name.ptr + ev.name.len);
+            size_t to = ev.value.ptr ? from + ev.value.len : from;
+            size_t len = strlen(e->value) + !ev.value.ptr;
+
+            if (line_end - line - (to - from) + len > INI_MAX_LINE - 1)
+                die("value too long: %s\n", e->value);
+            copy_to(in, from, out);
+            if (!ev.value.ptr)
+                putc(sep, out);
+            fputs(e->value, out);
+            copy_to(in, to, NULL);
+            e->done = dropping = 1;
+            break;
+        }
+    }
+    ini_reader_free(&r);
+    if (ret < 0)
+        die("failed to allocate memory\n");
+
+    size_t end = in->pos;
+    int newline = end > in->start && in->last != '\n';
+
+    if (!insert)
+        insert = in->start;
+    size_t n = insert_sets(in, insert, newline && insert == end, sep, out);
+    if (n > 0 && insert == end)
+        newline = 0;
+    copy_to(in, end, out);
+
+    // keys of sections not found go in new sections at the end
+    int blank = end > in->start || n > 0;
+    for (size_t i = 0; i < nedits; i++) {
+        struct edit *e = &edits[i];
+
+        if (!e->value || e->done || e->overridden)
+            continue;
+        if (newline)
+            putc('\n', out);
+        if (blank)
+            putc('\n', out);
+        newline = 0;
+        blank = 1;
+        if (*e->section)
+            fprintf(out, "[%s]\n", e->section);
+        for (size_t j = i; j < nedits; j++) {
+            struct edit *f = &edits[j];
+
+            if (f->value && !f->done && !f->overridden &&
+                    streq(f->section, e->section)) {
+                fprintf(out, "%s%c%s\n", f->key, sep, f->value);
+                f->done = 1;
+            }
+        }
+    }
+}
+
+/* Apply the edits to file, writing the result to a temporary file renamed
+   over the original, or to standard input, writing the result to standard
+   output. The file is mapped and standard input read a line at a time, so
+   memory use doesn't grow with their size. */
+static void
+edit_file(const char *file, ini_parser_config c, unsigned int index)
+{
+    struct edit_input in = {.file = stdin};
+
+    if (!file) {
+        apply_edits(&in, c, index, stdout);
+        free(in.held);
+        if (fflush(stdout) == EOF)
+            die("failed to write output\n");
+        return;
+    }
+
+    // replace the file a symbolic link points to, not the link
+    char *target = realpath(file, NULL);
+    struct stat st;
+    int fd;
+
+    if (!target || (fd = open(target, O_RDONLY)) < 0)
+        die("failed to open %s\n", file);
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+        die("%s: not a regular file\n", file);
+
+    void *map = NULL;
+
+    in.file = NULL;
+    in.data = in.buf = in.end = "";
+    if (st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+            die("failed to map %s\n", file);
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        in.data = in.buf = map;
+        in.end = in.buf + st.st_size;
+    }
+
+    size_t len = strlen(target) + 14;
+    char *tmp = xmalloc(len);
+    int tmp_fd;
+    FILE *out;
+
+    snprintf(tmp, len, "%s.iniq-XXXXXX", target);
+    if ((tmp_fd = mkstemp(tmp)) < 0)
+        die("failed to create %s\n", tmp);
+    // cleanup() removes it if editing fails
+    edit_tmp = tmp;
+    if (!(out = fdopen(tmp_fd, "w")))
+        die("failed to create %s\n", tmp);
+    // the new file keeps the original's permissions and, if allowed, owner
+    if (fchmod(tmp_fd, st.st_mode & 07777) < 0 ||
+            (fchown(tmp_fd, st.st_uid, st.st_gid) < 0 &&
+             fchmod(tmp_fd, st.st_mode & 0777) < 0))
+        die("failed to set the permissions of %s\n", tmp);
+
+    apply_edits(&in, c, index, out);
+
+    if (fflush(out) == EOF || fsync(tmp_fd) < 0 || fclose(out) == EOF ||
+            rename(tmp, target) < 0)
+        die("failed to write %s\n", file);
+    edit_tmp = NULL;
+
+    if (map)
+        munmap(map, st.st_size);
+    close(fd);
+    free(in.held);
+    free(tmp);
+    free(target);
+}
+
+static int
+filter_conf(const struct dirent *e)
+{
+    size_t len = strlen(e->d_name);
+    size_t suffix = strlen(CONF_SUFFIX);
+
+    return e->d_name[0] != '.' && len > suffix &&
+        streq(e->d_name + len - suffix, CONF_SUFFIX);
+}
+
+static void
+push_file(const char *file)
+{
+    files = xrealloc(files, sizeof(char *) * (nfiles + 1));
+    files[nfiles++] = file;
+}
+
+static void
+add_file(const char *path)
+{
+    struct stat st;
+    struct dirent **ents;
+    int n;
+
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        push_file(xstrdup(path));
+        return;
+    }
+
+    // a directory adds its *.conf files in lexical order
+    if ((n = scandir(path, &ents, filter_conf, alphasort)) < 0)
+        die("failed to read directory %s\n", path);
+
+    for (int i = 0; i < n; i++) {
+        size_t len = strlen(path) + strlen(ents[i]->d_name) + 2;
+        char *file = xmalloc(len);
+
+        snprintf(file, len, "%s/%s", path, ents[i]->d_name);
+        push_file(file);
+        free(ents[i]);
+    }
+    free(ents);
+}
+
+static unsigned int
+count_sections(const struct document *doc, const struct pattern *names)
+{
+    unsigned int i = 0;
+
+    for (struct section *s = doc->sections; s; s = s->next) {
+        // wildcards only match sections that would be listed
+        if (names->glob && !include_default &&
+                streq(s->name, DEFAULT_SECTION))
+            continue;
+        i += section_match(names, s->name);
+    }
+
+    return i;
+}
+
+/* Return the n arguments joined with ", ", or "stdin" if there are none. */
+static char *
+join_args(int n, char *args[])
+{
+    size_t len = sizeof("stdin");
+
+    for (int i = 0; i < n; i++)
+        len += strlen(args[i]) + 2;
+
+    char *str = xmalloc(len);
+    char *end = str;
+
+    for (int i = 0; i < n; i++)
+        end += sprintf(end, "%s%s", i > 0 ? ", " : "", args[i]);
+    if (n == 0)
+        strcpy(str, "stdin");
+    return str;
+}
+
+static void
 print_usage(int code)
 {
-    fputs("usage: iniq [options] [FILE]\n"
+    fputs("usage: iniq [options] [FILE...]\n"
           "\n"
-          "With no FILE, read standard input.\n"
+          "With no FILE, read standard input. Keys in later FILEs override\n"
+          "those in earlier ones. A directory FILE reads its *.conf files.\n"
           "\n"
           "options:\n"
           "  -h          Show help message\n"
@@ -406,6 +2852,8 @@ print_usage(int code)
           "  -D          Disable inheriting of DEFAULT section\n"
           "  -s SEPS     Key/value pair separators (default: '=:')\n"
           "  -m          Parse multi-line entries\n"
+          "  -j CHAR     Join lines of multi-line entries with CHAR\n"
+          "                (default: newline)\n"
           "  -c          Combine sections with the same name\n"
           "  -P SEP      Path separator character (default: '.')\n"
           "  -p PATH     Path specifying sections/keys to print\n"
@@ -416,7 +2864,22 @@ print_usage(int code)
           "  -o          Output sections, keys, and values\n"
           "  -O FILTER   Output according to FILTER\n"
           "                where FILTER is a comma-separated list of keys\n"
-          "  -v          Show version\n",
+          "  -w KEY=VALUE\n"
+          "              Print sections where KEY is VALUE, either of which\n"
+          "                may contain wildcards\n"
+          "  -v          Show version\n"
+          "  --diff      Print changes between two files, tab-separated:\n"
+          "                added|removed|changed, section, index, key,\n"
+          "                old value, new value\n"
+          "  --export[=PREFIX]\n"
+          "              Print keys as shell assignments to PREFIX[SECTION_]KEY\n"
+          "  --set SECTION.KEY=VALUE\n"
+          "              Set KEY in FILE, in place, keeping the rest as is\n"
+          "  --delete SECTION.KEY\n"
+          "              Delete KEY from FILE, in place\n"
+          "  --stats[=FORMAT]\n"
+          "              Print parse statistics to stderr\n"
+          "                where FORMAT is text (default) or json\n",
           code ? stderr : stdout);
 
     exit(code);
@@ -438,15 +2901,29 @@ main(int argc, char *argv[])
     ini_parser_config c = {
         .seps = NULL,
         .multi = 0,
+        .join = '\n',
     };
     const char *path = NULL;
     const char *fmt = NULL;
+    const char *where = NULL;
     char *filter = NULL;
     unsigned int section_index = 0;
     unsigned int output = 0;
+    int stats_opt = 0;
+    int diff = 0;
     int opt;
 
-    while ((opt = getopt(argc, argv, "hqdDs:mcP:p:ni:f:oO:v")) != -1) {
+    static const struct option long_opts[] = {
+        {"stats", optional_argument, NULL, OPT_STATS},
+        {"export", optional_argument, NULL, OPT_EXPORT},
+        {"diff", no_argument, NULL, OPT_DIFF},
+        {"set", required_argument, NULL, OPT_SET},
+        {"delete", required_argument, NULL, OPT_DELETE},
+        {NULL, 0, NULL, 0},
+    };
+
+    while ((opt = getopt_long(argc, argv, "hqdDs:mj:cP:p:ni:f:oO:w:v", long_opts,
+                    NULL)) != -1) {
         switch (opt) {
         case 'h': print_usage(EXIT_SUCCESS); break;
         case 'q': quiet = 1; break;
@@ -454,6 +2931,11 @@ main(int argc, char *argv[])
         case 'D': disable_default = 1; break;
         case 's': c.seps = optarg; break;
         case 'm': c.multi = 1; break;
+        case 'j':
+            if (strlen(optarg) != 1)
+                die("invalid join character: %s\n", optarg);
+            c.join = *optarg;
+            break;
         case 'c': combine_sections = 1; break;
         case 'P': path_sep = optarg; break;
         case 'p': path = optarg; break;
@@ -462,42 +2944,75 @@ main(int argc, char *argv[])
         case 'f': fmt = optarg; break;
         case 'o': output = 1; break;
         case 'O': output = 1; filter = optarg; break;
+        case 'w': where = optarg; break;
         case 'v': printf("%s\n", VERSION); exit(EXIT_SUCCESS);
+        case OPT_STATS:
+            if (optarg && !streq(optarg, "text") && !streq(optarg, "json"))
+                die("invalid statistics format: %s\n", optarg);
+            stats_opt = optarg && streq(optarg, "json") ? 2 : 1;
+            break;
+        case OPT_DIFF: diff = 1; error_status = 2; break;
+        case OPT_SET: push_edit(optarg, 1); break;
+        case OPT_DELETE: push_edit(optarg, 0); break;
+        case OPT_EXPORT:
+            export_prefix = optarg ? optarg : "";
+            for (const char *c = export_prefix; *c; c++) {
+                if (!isalnum((unsigned char)*c) && *c != '_')
+                    die("invalid export prefix: %s\n", export_prefix);
+            }
+            break;
         }
     }
 
     const char *file = argv[optind];
-
-    atexit(cleanup);
-
-    if (optind < argc) {
-        if (ini_parse(file, handler, c, NULL) < 0)
-            die("failed to parse %s\n", argv[optind]);
-    } else if (!feof(stdin)) {
-        if (ini_parse_file(stdin, handler, c, NULL) < 0)
-            die("failed to parse stdin\n");
-    } else {
-        print_usage(2);
-    }
-
+    struct query q = {0};
+    struct document *doc;
     struct section *s = NULL;
     struct section *d = NULL;
     const char *section = NULL;
     const char *key = NULL;
+    // key as given in the path, before its escapes are removed
+    const char *key_arg = NULL;
+    char buf[BUFSIZ];
+    int sectionless = 0;
+    int wildcard = 0;
     int keys = 0;
 
+    atexit(cleanup);
+
+    if (stats_opt) {
+#if INIQ_STATS
+        stats.enabled = 1;
+        stats.json = stats_opt == 2;
+        stats_mark(&stats.start);
+        atexit(print_stats);
+#else
+        die("--stats requires iniq to be built with STATS=1\n");
+#endif /* INIQ_STATS */
+    }
+
+    if (nedits) {
+        if (argc - optind > 1)
+            die("--set and --delete edit one file\n");
+        if (path || output || number_sections || where || export_prefix ||
+                diff)
+            die("--set and --delete can't be combined with -p, -o, -O, -n, "
+                    "-w, --export or --diff\n");
+        split_edits(c.seps, section_index);
+        edit_file(file, c, section_index);
+        exit(EXIT_SUCCESS);
+    }
+
     if (path) {
-        char *p = path_dup = strdup(path);
+        char *p = path_dup = xstrdup(path);
         size_t len = 0;
-        char buf[BUFSIZ];
         char *s;
 
         while ((s = strsep(&p, path_sep))) {
             if (streq(s, "") && len == 0) {
                 // path doesn't specify section
                 section = NO_SECTION;
-                // only real sections inherit DEFAULT section
-                disable_default = 1;
+                sectionless = 1;
 
                 /* anticipate a blank key. if the next char is not ., the path is
                    either . (keys is reverted to 0 below) or specifies a key (keys
@@ -526,39 +3041,220 @@ main(int argc, char *argv[])
         }
     }
 
+    if (section) {
+        // keys with no section are stored under "" section in inih
+        section_pattern = compile_pattern(streq(section, NO_SECTION) ? "" :
+                section, 0);
+        wildcard = section_pattern->glob;
+    }
+    if (key) {
+        key_arg = key;
+        key_pattern = compile_pattern(key, 0);
+        wildcard |= key_pattern->glob;
+        // literal key with its wildcard escapes removed
+        key = key_pattern->alts[0];
+    }
+    if (filter)
+        filter_pattern = compile_pattern(filter, 1);
+    if (where) {
+        const char *eq = strchr(where, '=');
+
+        if (!eq || eq == where)
+            die("invalid -w argument: %s\n", where);
+        if (key)
+            die("-w takes a section path, not a key\n");
+        if (output || number_sections || export_prefix || diff)
+            die("-w can't be combined with -o, -O, -n, --export or --diff\n");
+
+        char *k = xmemdup(where, eq - where);
+        where_key = compile_pattern(k, 0);
+        where_value = compile_pattern(eq + 1, 0);
+        free(k);
+    }
+
+    // a wildcard path selects sections and keys to output
+    if (wildcard && !number_sections) {
+        output = 1;
+        if (key_pattern)
+            filter_pattern = key_pattern, key_pattern = NULL;
+    }
+
+    // a diff compares everything output would print, and a literal path
+    // narrows it like a wildcard one
+    if (diff) {
+        if (key_pattern && filter_pattern)
+            die("--diff takes keys from PATH or -O, not both\n");
+        if (key_pattern)
+            filter_pattern = key_pattern, key_pattern = NULL;
+        output = 1;
+    }
+
+    // export takes -O as a filter; without a literal section, it exports
+    // every selected section like output does
+    if (export_prefix)
+        output = !section || wildcard;
+
+    // output ignores the path's section unless it has wildcards
+    if (output) {
+        q.section = wildcard || diff ? section_pattern : NULL;
+        q.key = filter_pattern;
+    } else if (section) {
+        q.section = section_pattern;
+        q.key = key_pattern;
+        q.no_pairs = number_sections;
+    }
+    q.sectionless = sectionless;
+    // the first pair found for a literal key is the one printed
+    q.first_only = key && !output && !number_sections && !export_prefix;
+    q.index = section_index;
+
+    // listing and counting sections only needs their headers
+    if ((!path && !output) || (section && number_sections))
+        q.no_pairs = q.headers_only = 1;
+
+    // -w only needs the sections in the path, and only the keys it compares
+    if (where) {
+        q.section = section ? section_pattern : NULL;
+        q.key = where_key;
+        q.no_pairs = q.headers_only = 0;
+    }
+
+    if (diff) {
+        // each side is one file, not layered
+        if (argc - optind != 2)
+            die("--diff needs two files\n");
+        push_file(xstrdup(argv[optind]));
+        push_file(xstrdup(argv[optind + 1]));
+    } else if (optind < argc) {
+        for (int i = optind; i < argc; i++)
+            add_file(argv[i]);
+    } else if (!feof(stdin)) {
+        push_file(NULL);
+    } else {
+        print_usage(2);
+    }
+
+    // messages name the files and directories given, as a lookup in layers
+    // can fail in no single one of them
+    input_name = join_args(argc - optind, argv + optind);
+
+    // an empty directory still has an empty document
+    layers = calloc(nfiles ? nfiles : 1, sizeof(struct document));
+    if (!layers)
+        die("failed to allocate memory\n");
+    for (size_t i = 0; i < (nfiles ? nfiles : 1); i++)
+        layers[i].query = &q;
+    doc = &layers[0];
+
+    if (nfiles > 1 && key && !output && !number_sections && !export_prefix) {
+        int found = 0;
+
+        // only real sections inherit DEFAULT section
+        if (sectionless)
+            disable_default = 1;
+
+        if (print_layered_value(fmt, section_pattern->alts[0], section_index,
+                    key, c, &found))
+            exit(EXIT_SUCCESS);
+        if (!found)
+            die("%s: section '%s' (index %d) not found\n", input_name, section,
+                    section_index);
+        if (sectionless)
+            die("%s: key '%s' not found\n", input_name, key);
+        die("%s: key '%s' not found in section '%s'\n", input_name, key, section);
+    }
+
+    parse_layers(c, !diff);
+
+    // exit with 1 if the files differ; with a key filter only keys are
+    // compared
+    if (diff)
+        exit(print_diff(&layers[0], &layers[1], !filter_pattern) ?
+                EXIT_FAILURE : EXIT_SUCCESS);
+
+    STAT(stats_mark(&stats.parsed));
+    PROBE(query__start);
+
+    // only real sections inherit DEFAULT section
+    if (sectionless)
+        disable_default = 1;
+
+    // like grep(1), -w fails if no section matches
+    if (where) {
+        if (!disable_default)
+            d = get_section(doc, DEFAULT_SECTION, 0);
+        build_bloom(doc);
+        exit(print_where(doc, fmt, q.section, d) ? EXIT_SUCCESS :
+                EXIT_FAILURE);
+    }
+
     if (section) {
         if (number_sections) {
-            unsigned int i = 0;
-            while (get_section(section, i))
-                i++;
+            unsigned int i = count_sections(doc, section_pattern);
             printf("%d\n", i);
             exit(i > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
         }
-        if (!(s = get_section(section, section_index)))
-            die("%s: section '%s' (index %d) not found\n", file, section,
+        if (!wildcard &&
+                !(s = get_section(doc, section_pattern->alts[0], section_index)))
+            die("%s: section '%s' (index %d) not found\n", input_name, section,
                     section_index);
     }
 
     if (!disable_default)
-        d = get_section(DEFAULT_SECTION, 0);
+        d = get_section(doc, DEFAULT_SECTION, 0);
+
+    // most lookups from here on are of keys inherited from DEFAULT, which
+    // sections rarely redefine
+    build_bloom(doc);
+
+    STAT(stats_mark(&stats.queried));
+    PROBE(query__done);
+
+    if (export_prefix) {
+        if (output) {
+            add_export_sections(doc, q.section, filter_pattern, d);
+        } else if (!add_exports(s, d, key ? key_pattern : filter_pattern, 0)
+                && key) {
+            if (sectionless)
+                die("%s: key '%s' not found\n", input_name, key);
+            die("%s: key '%s' not found in section '%s'\n", input_name, key,
+                    section);
+        }
+        print_exports();
+        exit(EXIT_SUCCESS);
+    }
+
+    if (output) {
+        int n = print_output(doc, fmt, q.section, filter_pattern, d);
+        const char *keys_arg = key_arg ? key_arg : filter;
 
-    if (output)
-        exit(print_output(fmt, filter, d) > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        // without wildcards, output succeeds if the file has any sections
+        if (!wildcard)
+            exit(doc->sections ? EXIT_SUCCESS : EXIT_FAILURE);
+        if (n > 0)
+            exit(EXIT_SUCCESS);
+        if (!keys_arg)
+            die("%s: no section matching '%s'\n", input_name, section);
+        if (sectionless)
+            die("%s: no key matching '%s'\n", input_name, keys_arg);
+        die("%s: no key matching '%s' in section '%s'\n", input_name,
+                keys_arg, section);
+    }
 
     if (key) {
         if (!print_value(fmt, s, key)) {
             if (section) {
                 if (!d || !print_value(fmt, d, key))
-                    die("%s: key '%s' not found in section '%s'\n", file, key,
+                    die("%s: key '%s' not found in section '%s'\n", input_name, key,
                             section);
             } else {
-                die("%s: key '%s' not found\n", file, key);
+                die("%s: key '%s' not found\n", input_name, key);
             }
         }
     } else if (section) {
         print_pairs(fmt, s, d, keys, '\n', NULL, 0);
         printf("\n");
-    } else if (!print_sections(fmt)) {
-        die("%s: no sections\n", file);
+    } else if (!print_sections(doc, fmt)) {
+        die("%s: no sections\n", input_name);
     }
 }
@@ -0,0 +1,447 @@
+/* This project is licensed under the New BSD License (see LICENSE). */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(INIQ_IO_URING)
+#define INIQ_IO_URING 1
+#endif /* __linux__ */
+
+#if INIQ_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifndef __NR_io_uring_setup
+#undef INIQ_IO_URING
+#define INIQ_IO_URING 0
+#endif /* __NR_io_uring_setup */
+#endif /* INIQ_IO_URING */
+
+#include "io.h"
+
+/* Size of the first read of each file. Buffers double until a read hits the
+   end of the file. */
+#define READ_SIZE BUFSIZ
+
+/* Most files submitted to the ring in one batch. */
+#define RING_ENTRIES 256
+
+/* Work shared by the threads reading files when io_uring isn't used. */
+struct read_jobs {
+    pthread_mutex_t lock;
+    const char **paths;
+    struct file_buf *bufs;
+    size_t n;
+    size_t next;
+};
+
+static int
+grow(struct file_buf *b, size_t *size)
+{
+    char *data = realloc(b->data, *size * 2);
+
+    if (!data) {
+        b->err = ENOMEM;
+        return -1;
+    }
+
+    b->data = data;
+    *size *= 2;
+    return 0;
+}
+
+static void
+read_file(const char *path, struct file_buf *b)
+{
+    size_t size = READ_SIZE;
+    ssize_t r;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        b->err = errno;
+        return;
+    }
+
+    if (!(b->data = malloc(size))) {
+        b->err = ENOMEM;
+        close(fd);
+        return;
+    }
+
+    while ((r = read(fd, b->data + b->len, size - b->len)) != 0) {
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            b->err = errno;
+            break;
+        }
+        b->len += r;
+        if (b->len == size && grow(b, &size) < 0)
+            break;
+    }
+
+    close(fd);
+    if (b->err) {
+        free(b->data);
+        b->data = NULL;
+        b->len = 0;
+    }
+}
+
+static void *
+read_jobs(void *arg)
+{
+    struct read_jobs *jobs = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&jobs->lock);
+        size_t i = jobs->next++;
+        pthread_mutex_unlock(&jobs->lock);
+
+        if (i >= jobs->n)
+            break;
+        if (jobs->paths[i])
+            read_file(jobs->paths[i], &jobs->bufs[i]);
+    }
+
+    return NULL;
+}
+
+static void
+read_files_threaded(const char **paths, size_t n, struct file_buf *bufs)
+{
+    struct read_jobs jobs = {
+        .paths = paths,
+        .bufs = bufs,
+        .n = n,
+        .next = 0,
+    };
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = ncpu > 0 && (size_t)ncpu < n ? (size_t)ncpu : n;
+    pthread_t *threads = nthreads > 1 ? malloc(sizeof(pthread_t) * nthreads)
+                                      : NULL;
+    size_t started = 0;
+
+    pthread_mutex_init(&jobs.lock, NULL);
+    while (threads && started < nthreads &&
+           !pthread_create(&threads[started], NULL, read_jobs, &jobs))
+        started++;
+
+    // the calling thread always takes part, so no thread is not fatal
+    read_jobs(&jobs);
+
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&jobs.lock);
+    free(threads);
+}
+
+#if INIQ_IO_URING
+/* Submission and completion queues shared with the kernel. */
+struct ring {
+    int fd;
+    unsigned entries;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_size;
+    size_t cq_map_size;
+};
+
+/* Per-file state while its reads are in flight. */
+struct ring_file {
+    int fd;
+    int done;
+    size_t size;
+};
+
+static void
+ring_free(struct ring *r)
+{
+    if (r->sqes)
+        munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+    if (r->cq_map && r->cq_map != r->sq_map)
+        munmap(r->cq_map, r->cq_map_size);
+    if (r->sq_map)
+        munmap(r->sq_map, r->sq_map_size);
+    close(r->fd);
+}
+
+static void *
+ring_map(int fd, size_t size, off_t offset)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static int
+ring_init(struct ring *r, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+
+    // reads at the current file position (-1 offset) arrived with the
+    // open and close opcodes, so this rules out kernels without them
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        close(r->fd);
+        return -1;
+    }
+
+    r->entries = p.sq_entries;
+    r->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_map_size > r->sq_map_size)
+            r->sq_map_size = r->cq_map_size;
+        r->cq_map_size = r->sq_map_size;
+    }
+
+    r->sq_map = ring_map(r->fd, r->sq_map_size, IORING_OFF_SQ_RING);
+    if (r->sq_map && (p.features & IORING_FEAT_SINGLE_MMAP))
+        r->cq_map = r->sq_map;
+    else if (r->sq_map)
+        r->cq_map = ring_map(r->fd, r->cq_map_size, IORING_OFF_CQ_RING);
+    if (r->cq_map)
+        r->sqes = ring_map(r->fd, r->entries * sizeof(struct io_uring_sqe),
+                           IORING_OFF_SQES);
+    if (!r->sqes) {
+        ring_free(r);
+        return -1;
+    }
+
+    char *sq = r->sq_map;
+    char *cq = r->cq_map;
+
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+/* Submit the first n entries of r->sqes and wait for all of them, storing the
+   result of each in res by its user_data. Returns -1 if the ring failed with
+   entries in flight, which can't be recovered. */
+static int
+ring_run(struct ring *r, unsigned n, int *res)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned submitted = 0;
+    unsigned reaped = 0;
+
+    for (unsigned i = 0; i < n; i++)
+        r->sq_array[(tail + i) & *r->sq_mask] = i;
+    __atomic_store_n(r->sq_tail, tail + n, __ATOMIC_RELEASE);
+
+    while (reaped < n) {
+        long ret = syscall(__NR_io_uring_enter, r->fd, n - submitted, 1,
+                           IORING_ENTER_GETEVENTS, NULL, 0);
+
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            return -1;
+        }
+        submitted += ret;
+
+        unsigned head = *r->cq_head;
+        unsigned ctail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != ctail; head++, reaped++) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+
+            res[cqe->user_data] = cqe->res;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+static struct io_uring_sqe *
+ring_sqe(struct ring *r, unsigned i, int opcode, int fd)
+{
+    struct io_uring_sqe *sqe = &r->sqes[i];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = i;
+    return sqe;
+}
+
+/* Read a batch of at most r->entries files: one submission opens them all,
+   then each round reads the next part of every file not yet at its end, and
+   a last submission closes them. Small files take four system calls per
+   batch however many there are. */
+static int
+ring_read_batch(struct ring *r, const char **paths, size_t n,
+        struct file_buf *bufs, struct ring_file *files, int *res)
+{
+    unsigned count = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        files[i].fd = -1;
+        files[i].done = 1;
+        if (!paths[i])
+            continue;
+
+        struct io_uring_sqe *sqe = ring_sqe(r, count, IORING_OP_OPENAT,
+                                            AT_FDCWD);
+
+        sqe->addr = (unsigned long)paths[i];
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = i;
+        count++;
+    }
+    if (ring_run(r, count, res) < 0)
+        return -1;
+
+    for (size_t i = 0; i < n; i++) {
+        if (!paths[i])
+            continue;
+        if (res[i] < 0) {
+            bufs[i].err = -res[i];
+        } else if (!(bufs[i].data = malloc(READ_SIZE))) {
+            bufs[i].err = ENOMEM;
+            close(res[i]);
+        } else {
+            files[i].fd = res[i];
+            files[i].done = 0;
+            files[i].size = READ_SIZE;
+        }
+    }
+
+    for (;;) {
+        count = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (files[i].done)
+                continue;
+
+            struct io_uring_sqe *sqe = ring_sqe(r, count, IORING_OP_READ,
+                                                files[i].fd);
+
+            sqe->addr = (unsigned long)(bufs[i].data + bufs[i].len);
+            sqe->len = files[i].size - bufs[i].len;
+            sqe->off = (unsigned long long)-1;
+            sqe->user_data = i;
+            count++;
+        }
+        if (!count)
+            break;
+        if (ring_run(r, count, res) < 0)
+            return -1;
+
+        for (size_t i = 0; i < n; i++) {
+            if (files[i].done)
+                continue;
+            if (res[i] == -EINTR || res[i] == -EAGAIN)
+                continue;
+            if (res[i] < 0) {
+                bufs[i].err = -res[i];
+                files[i].done = 1;
+            } else if (res[i] == 0) {
+                files[i].done = 1;
+            } else {
+                bufs[i].len += res[i];
+                if (bufs[i].len == files[i].size &&
+                    grow(&bufs[i], &files[i].size) < 0)
+                    files[i].done = 1;
+            }
+        }
+    }
+
+    count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (files[i].fd < 0)
+            continue;
+        ring_sqe(r, count, IORING_OP_CLOSE, files[i].fd)->user_data = i;
+        count++;
+    }
+    if (ring_run(r, count, res) < 0)
+        return -1;
+
+    for (size_t i = 0; i < n; i++) {
+        if (bufs[i].err) {
+            free(bufs[i].data);
+            bufs[i].data = NULL;
+            bufs[i].len = 0;
+        }
+    }
+
+    return 0;
+}
+
+static int
+read_files_ring(const char **paths, size_t n, struct file_buf *bufs)
+{
+    struct ring r;
+    unsigned entries = n < RING_ENTRIES ? n : RING_ENTRIES;
+
+    if (ring_init(&r, entries) < 0)
+        return -1;
+
+    struct ring_file *files = malloc(sizeof(*files) * r.entries);
+    int *res = malloc(sizeof(*res) * r.entries);
+
+    if (!files || !res) {
+        free(files);
+        free(res);
+        ring_free(&r);
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; i += r.entries) {
+        size_t batch = n - i < r.entries ? n - i : r.entries;
+
+        // requests still in flight may write to the batch's buffers, so
+        // they are abandoned rather than freed, and threads read the files
+        // left into new ones
+        if (ring_read_batch(&r, paths + i, batch, bufs + i, files, res) < 0) {
+            memset(bufs + i, 0, sizeof(*bufs) * (n - i));
+            read_files_threaded(paths + i, n - i, bufs + i);
+            break;
+        }
+    }
+
+    free(files);
+    free(res);
+    ring_free(&r);
+    return 0;
+}
+#endif /* INIQ_IO_URING */
+
+void
+read_files(const char **paths, size_t n, struct file_buf *bufs)
+{
+    memset(bufs, 0, sizeof(*bufs) * n);
+
+#if INIQ_IO_URING
+    // a single file gains nothing from batching
+    if (n > 1 && read_files_ring(paths, n, bufs) == 0)
+        return;
+#endif /* INIQ_IO_URING */
+
+    read_files_threaded(paths, n, bufs);
+}
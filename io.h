@@ -0,0 +1,22 @@
+/* This project is licensed under the New BSD License (see LICENSE). */
+
+#ifndef IO_H
+#define IO_H
+
+#include <stddef.h>
+
+/* Contents of a file read by read_files(). On error data is NULL and err is
+   the errno value of the failed open or read. */
+struct file_buf {
+    char *data;
+    size_t len;
+    int err;
+};
+
+/* Read the n files named by paths into bufs, skipping NULL paths. On Linux
+   the opens, reads and closes of many files are submitted as io_uring
+   batches, otherwise (or when io_uring is unavailable) a pool of threads
+   reads the files. The caller frees each data buffer. */
+void read_files(const char **paths, size_t n, struct file_buf *bufs);
+
+#endif /* IO_H */
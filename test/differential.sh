@@ -0,0 +1,210 @@
+#!/bin/sh
+#
+# Compare iniq against a reference build on random files and options, and
+# shrink the first case where their output or exit status differs.
+#
+# usage: differential.sh REFERENCE [INIQ]
+#
+# REFERENCE is iniq built from the revision to compare against (see
+# `make differential`), or another build of the same source, such as
+# bench/iniq-generic. Set RUNS to change the number of cases (default: 500)
+# and SEED to generate other ones (default: 1). Set SKIP to a list of options,
+# such as "-m -j", whose output intentionally differs from REFERENCE, to leave
+# them out of the generated cases.
+
+set -e
+
+ref=$1
+iniq=${2:-./iniq}
+runs=${RUNS:-500}
+seed=${SEED:-1}
+skip=${SKIP:-}
+
+if [ -z "$ref" ]; then
+    echo "usage: $0 REFERENCE [INIQ]" >&2
+    exit 2
+fi
+
+tab=$(printf '\t')
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# generate SEED CONF OPTS
+#
+# Write a random file to CONF and the options to query it with to OPTS, one
+# per line, with an option's argument after a tab. Names avoid wildcard
+# characters, as wildcard paths are not compared. Options in SKIP are left
+# out.
+generate() {
+    awk -v seed="$1" -v conf="$2" -v opts="$3" -v skip=" $skip " '
+    function opt(o) {
+        if (!index(skip, " " o " "))
+            print o > opts
+    }
+    function optarg(o, a) {
+        if (!index(skip, " " o " "))
+            print o "\t" a > opts
+    }
+    function pick(list,    a, n) {
+        n = split(list, a, "|")
+        return a[int(rand() * n) + 1]
+    }
+    function escape(name,    out, i, c) {
+        out = ""
+        for (i = 1; i <= length(name); i++) {
+            c = substr(name, i, 1)
+            out = out (c == psep ? "\\" : "") c
+        }
+        return out
+    }
+    BEGIN {
+        srand(seed)
+        sections = "a|b|a.b|a,b|x y|DEFAULT|sec"
+        keys = "k|key|a|k.1|k,2|x y"
+        values = "v||1|true|x y|\"q\"|v ; comment|v=w|a:b"
+
+        seps = rand() < 0.3 ? pick("=|:|!|=!|:!") : "=:"
+        sep = substr(seps, int(rand() * length(seps)) + 1, 1)
+        psep = rand() < 0.2 ? pick(",|:") : "."
+        n = int(rand() * 25)
+        for (i = 0; i < n; i++) {
+            r = rand()
+            if (r < 0.2) {
+                section = pick(sections)
+                printf "[%s]\n", section > conf
+            } else if (r < 0.75) {
+                printf "%s%s%s%s%s\n", pick("||  "), pick(keys),
+                    pick("| "), sep, pick("| ") pick(values) > conf
+            } else if (r < 0.83) {
+                print pick(";|#") " comment" > conf
+            } else if (r < 0.9) {
+                print "" > conf
+            } else {
+                print pick("  |\t") pick(values) > conf
+            }
+        }
+        # the last line may lack a newline
+        if (rand() < 0.2)
+            printf "%s%s%s", pick(keys), sep, pick(values) > conf
+        close(conf)
+
+        if (seps != "=:" || rand() < 0.1)
+            optarg("-s", seps)
+        if (psep != ".")
+            optarg("-P", psep)
+        if (rand() < 0.3) {
+            opt("-m")
+            if (rand() < 0.3)
+                optarg("-j", pick(",| "))
+        }
+        if (rand() < 0.2)
+            opt("-c")
+        if (rand() < 0.2)
+            opt("-D")
+        if (rand() < 0.2)
+            opt("-d")
+        if (rand() < 0.3)
+            optarg("-i", int(rand() * 3))
+
+        section = escape(pick(sections))
+        key = pick(keys)
+        r = rand()
+        if (r < 0.15) {
+            # list sections
+        } else if (r < 0.3) {
+            optarg("-p", section)
+        } else if (r < 0.5) {
+            optarg("-p", section psep key)
+        } else if (r < 0.6) {
+            optarg("-p", pick(psep "|" psep psep "|" psep key))
+        } else if (r < 0.7) {
+            optarg("-p", section psep)
+        } else if (r < 0.8) {
+            optarg("-p", section)
+            opt("-n")
+        } else if (r < 0.9) {
+            opt("-o")
+        } else {
+            optarg("-O", pick(keys) (rand() < 0.5 ? "," pick(keys) : ""))
+        }
+        if (rand() < 0.25)
+            optarg("-f", pick("%k:%v|%v|[%s]|%s %k|%k=%v;"))
+        close(opts)
+    }'
+}
+
+# run BIN CONF OPTS OUT
+#
+# Run BIN with the options in OPTS on CONF, writing its output and exit
+# status to OUT.
+run() {
+    bin=$1
+    conf=$2
+    args=$3
+    out=$4
+    set --
+    while IFS= read -r a; do
+        case $a in
+        *"$tab"*) set -- "$@" "${a%%"$tab"*}" "${a#*"$tab"}" ;;
+        *) set -- "$@" "$a" ;;
+        esac
+    done < "$args"
+    status=0
+    "$bin" "$@" "$conf" < /dev/null > "$out" 2> /dev/null || status=$?
+    echo "exit status $status" >> "$out"
+}
+
+# differs CONF OPTS
+differs() {
+    run "$ref" "$1" "$2" "$tmp/ref.out"
+    run "$iniq" "$1" "$2" "$tmp/iniq.out"
+    ! cmp -s "$tmp/ref.out" "$tmp/iniq.out"
+}
+
+# shrink CONF OPTS FILE
+#
+# Remove lines from FILE, which is CONF or OPTS, one at a time while the
+# outputs still differ.
+shrink() {
+    n=$(awk 'END { print NR }' "$3")
+    i=1
+    while [ "$i" -le "$n" ]; do
+        sed "${i}d" "$3" > "$tmp/shrink"
+        cp "$3" "$tmp/keep"
+        cp "$tmp/shrink" "$3"
+        if differs "$1" "$2"; then
+            n=$((n - 1))
+        else
+            cp "$tmp/keep" "$3"
+            i=$((i + 1))
+        fi
+    done
+}
+
+i=0
+while [ "$i" -lt "$runs" ]; do
+    conf="$tmp/case.conf"
+    opts="$tmp/case.opts"
+    : > "$conf"
+    : > "$opts"
+    generate $((seed + i)) "$conf" "$opts"
+
+    if differs "$conf" "$opts"; then
+        shrink "$conf" "$opts" "$conf"
+        shrink "$conf" "$opts" "$opts"
+        differs "$conf" "$opts" || true
+        echo "case $((seed + i)) differs"
+        echo "--- options"
+        tr '\t' ' ' < "$opts"
+        echo "--- file"
+        cat "$conf"
+        echo "--- $ref"
+        cat "$tmp/ref.out"
+        echo "--- $iniq"
+        cat "$tmp/iniq.out"
+        exit 1
+    fi
+    i=$((i + 1))
+done
+
+echo "$runs cases match"
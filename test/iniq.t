@@ -53,6 +53,26 @@ test "$(iniq -D -f %v:%k -p section1 test.conf)" = "a:keyA
 b:keyB"
 '
 
+test_expect_success 'List sections with multi-line entry' '
+test "$(iniq headers.conf)" = "one
+continued
+two" &&
+test "$(iniq -m headers.conf)" = "one
+two" &&
+test "$(iniq -m -p continued -n headers.conf)" = "0"
+'
+
+test_expect_success 'List sections of piped input a chunk at a time' '
+big="$SHARNESS_TRASH_DIRECTORY/big.conf" &&
+long=$(printf "%0300d" 0) &&
+seq 3000 | sed "s/.*/[s&]\\nk=$long\\n  [c&]/" >"$big" &&
+iniq "$big" >"$big.out" &&
+test $(wc -l <"$big.out") = 6000 &&
+cat "$big" | iniq >"$big.pipe" &&
+test_cmp "$big.out" "$big.pipe" &&
+test "$(cat "$big" | iniq -m -n -p "s*")" = 3000
+'
+
 test_expect_success 'List sections with the same name' '
 test "$(iniq multi.conf)" = "multi
 multi"
@@ -70,6 +90,11 @@ test_expect_success 'Get number of sections' '
 test "$(iniq -p multi -n multi.conf)" = "2"
 '
 
+test_expect_success 'Get key inherited from DEFAULT in combined section' '
+test "$(iniq -c -p multi.default2 multi.conf)" = "2" &&
+test "$(iniq -c -p multi.key3 multi.conf)" = "3"
+'
+
 test_expect_success 'Get section by index' '
 test "$(iniq -D -p multi. -i 0 multi.conf)" = "key1" &&
 test "$(iniq -D -p multi. -i 1 multi.conf)" = "key2
@@ -87,8 +112,17 @@ line2=2"
 '
 
 test_expect_success 'Get multi-line entry' '
-test "$(iniq -p indented -m indented.conf)" = "line1=1
-line1=line2=2"
+test "$(iniq -p indented.line1 -m indented.conf)" = "1
+line2=2" &&
+test "$(iniq -o -D -m indented.conf)" = "section=indented line1=1
+line2=2"
+'
+
+test_expect_success 'Join multi-line entry' '
+test "$(iniq -p indented.line1 -m -j _ indented.conf)" = "1_line2=2" &&
+test "$(iniq -o -D -m -j "," indented.conf)" = "section=indented line1=1,line2=2" &&
+test_must_fail iniq -p indented.line1 -m -j "" indented.conf &&
+test_must_fail iniq -p indented.line1 -m -j ab indented.conf
 '
 
 test_expect_success 'Escape section name' '
@@ -129,6 +163,10 @@ test_expect_success 'Output all (keyless, disable DEFAULT)' '
 test "$(iniq -o -D keyless.conf)" = "section=keyless"
 '
 
+test_expect_success 'Output all (quoted values)' '
+test "$(iniq -o quote.conf)" = "section=quote spaces='"'a b'"' quoted='"'a b'"' dquoted=\"a b\" plain=ab"
+'
+
 test_expect_success 'Output filtered' '
 test "$(iniq -O keyA test.conf)" = "section=section1 keyA=a"
 '
@@ -138,6 +176,282 @@ test "$(iniq -O default,keyB test.conf)" = "section= default=true
 section=section1 default=true keyB=b"
 '
 
+test_expect_success 'Get keys from large section' '
+test "$(iniq -p large.key5 large.conf)" = "5" &&
+test "$(iniq -p large.key20 large.conf)" = "20" &&
+test "$(iniq -f %k -p large large.conf | head -n 2)" = "inherited
+key1" &&
+test "$(iniq -p large.key1 large.conf)" = "1"
+'
+
+test_expect_success 'Get keys with wildcard path' '
+test "$(iniq -p "web-*.port" wildcard.conf)" = "section=web-1 port=80
+section=web-2 port=81" &&
+test "$(iniq -f %v -p "*.enabled" wildcard.conf)" = "web-1 true
+web-2 false
+db false
+a*b false"
+'
+
+test_expect_success 'Get multiple keys with brace path' '
+test "$(iniq -p "db.{host,port}" wildcard.conf)" = "section=db host=h port=5432" &&
+test "$(iniq -p "{db,web-1}.port" wildcard.conf)" = "section=web-1 port=80
+section=db port=5432"
+'
+
+test_expect_success 'Get number of sections matching wildcard' '
+test "$(iniq -p "web-?" -n wildcard.conf)" = "2" &&
+test "$(iniq -p "*" -n wildcard.conf)" = "4"
+'
+
+test_expect_success 'Escape wildcard in path' '
+test "$(iniq -p "a\\*b.k" wildcard.conf)" = "v"
+'
+
+test_expect_success 'Match unbalanced brace literally' '
+printf "[s]\na{b=1\nc=2\n" >"$SHARNESS_TRASH_DIRECTORY/brace.conf" &&
+test "$(iniq -p "s.a{b" "$SHARNESS_TRASH_DIRECTORY/brace.conf")" = "1" &&
+test "$(iniq -O "a{b" "$SHARNESS_TRASH_DIRECTORY/brace.conf")" = "section=s a{b=1" &&
+test "$(iniq -O "a{b,c" "$SHARNESS_TRASH_DIRECTORY/brace.conf")" = "section=s a{b=1 c=2"
+'
+
+test_expect_success 'Fail on unmatched wildcard path' '
+test_must_fail iniq -p "nope-*.port" wildcard.conf &&
+test "$(iniq -p "db.nope*" wildcard.conf 2>&1)" = \
+    "wildcard.conf: no key matching '"'"'nope*'"'"' in section '"'"'db'"'"'" &&
+test "$(iniq -p "nope-*" wildcard.conf 2>&1)" = \
+    "wildcard.conf: no section matching '"'"'nope-*'"'"'"
+'
+
+test_expect_success 'List sections in layered files' '
+test "$(iniq test.conf conf.d)" = "section1
+section2"
+'
+
+test_expect_success 'Get keys from layered files' '
+test "$(iniq -p section1.keyA test.conf conf.d)" = "override" &&
+test "$(iniq -p section1.keyB test.conf conf.d)" = "b" &&
+test "$(iniq -p section1.keyC test.conf conf.d)" = "last" &&
+test "$(iniq -p .free test.conf conf.d)" = "1"
+'
+
+test_expect_success 'Inherit DEFAULT across layered files' '
+test "$(iniq -p section1.default test.conf conf.d)" = "false" &&
+test "$(iniq -p section2.default test.conf conf.d)" = "false" &&
+test_must_fail iniq -D -p section2.default test.conf conf.d
+'
+
+test_expect_success 'Name the layered files in errors' '
+test "$(iniq -p section1.nope test.conf conf.d 2>&1)" = \
+    "test.conf, conf.d: key '"'"'nope'"'"' not found in section '"'"'section1'"'"'" &&
+test "$(iniq -o test.conf nonexistent.conf 2>&1)" = \
+    "failed to parse nonexistent.conf" &&
+test "$(iniq -p section1.nope <test.conf 2>&1)" = \
+    "stdin: key '"'"'nope'"'"' not found in section '"'"'section1'"'"'"
+'
+
+test_expect_success 'Output all (layered files)' '
+test "$(iniq -o test.conf conf.d)" = "section= default=false no_section=true free=1
+section=section1 default=false keyA=override keyB=b keyC=last
+section=section2 default=false key=2"
+'
+
+test_expect_success 'Read many layered files' '
+many="$SHARNESS_TRASH_DIRECTORY/many" &&
+mkdir "$many" &&
+for i in $(seq 300); do
+    printf "[s%d]\nk=%d\n[common]\nv=%d\n" $i $i $i >"$many/$(printf %03d $i).conf" ||
+    return 1
+done &&
+awk "BEGIN { print \"[big]\"; for (i = 0; i < 5000; i++) print \"k\" i \"=\" i }" >"$many/big.conf" &&
+test "$(iniq "$many" | wc -l)" -eq 302 &&
+iniq -o "$many" >"$many.out" &&
+test "$(grep "^section=common " "$many.out")" = "section=common v=300" &&
+grep -q "^section=big k0=0 .* k4999=4999$" "$many.out"
+'
+
+test_expect_success 'Stop reading once the key is found' '
+early="$SHARNESS_TRASH_DIRECTORY/early.conf" &&
+{ printf "[s]\nk=v\n" && seq 100000 | sed "s/^/x=/"; } >"$early" &&
+{ test "$(iniq -p s.k)" = "v" && test -n "$(cat)"; } <"$early"
+'
+
+test_expect_success 'Export keys as shell assignments' '
+test "$(iniq --export test.conf)" = "no_section='"'"'true'"'"'
+free='"'"'1'"'"'
+section1_default='"'"'true'"'"'
+section1_keyA='"'"'a'"'"'
+section1_keyB='"'"'b'"'"'" &&
+test "$(iniq --export=C_ -p section1 -O "key*" test.conf)" = "C_keyA='"'"'a'"'"'
+C_keyB='"'"'b'"'"'" &&
+test_must_fail iniq --export=C- test.conf
+'
+
+test_expect_success 'Export values that eval reads back verbatim' '
+eval "$(iniq --export -p quote quote.conf)" &&
+test "$quoted" = "'"'"'a b'"'"'" &&
+test "$dquoted" = "\"a b\"" &&
+test "$spaces" = "a b" &&
+eval "$(iniq --export -p quote.plain quote.conf)" &&
+test "$plain" = "ab" &&
+test_must_fail iniq --export -p quote.nope quote.conf
+'
+
+test_expect_success 'Reject exports to the same or no variable name' '
+collide="$SHARNESS_TRASH_DIRECTORY/collide.conf" &&
+unnamed="$SHARNESS_TRASH_DIRECTORY/unnamed.conf" &&
+printf "[other]\na.b=1\na_b=2\n[a b]\nk=1\n[a_b]\nk=2\n" >"$collide" &&
+test_must_fail iniq --export "$collide" &&
+test_must_fail iniq --export -p other "$collide" &&
+test_must_fail iniq --export -p "a?b" "$collide" &&
+test "$(iniq --export -p other -O a.b "$collide")" = "a_b='"'"'1'"'"'" &&
+printf "=v\n" >"$unnamed" &&
+test_must_fail iniq --export "$unnamed" &&
+test "$(iniq --export=p_ "$unnamed")" = "p_='"'"'v'"'"'"
+'
+
+test_expect_success 'Diff two files' '
+diff="$SHARNESS_TRASH_DIRECTORY/diff" &&
+test_expect_code 1 iniq --diff test.conf conf.d/10-override.conf >"$diff.out" &&
+printf "removed\t\t0\t\t\t\n" >"$diff.expected" &&
+printf "removed\t\t0\tno_section\ttrue\t\n" >>"$diff.expected" &&
+printf "removed\t\t0\tfree\t1\t\n" >>"$diff.expected" &&
+printf "changed\tsection1\t0\tdefault\ttrue\tfalse\n" >>"$diff.expected" &&
+printf "changed\tsection1\t0\tkeyA\ta\toverride\n" >>"$diff.expected" &&
+printf "removed\tsection1\t0\tkeyB\tb\t\n" >>"$diff.expected" &&
+printf "added\tsection1\t0\tkeyC\t\tc\n" >>"$diff.expected" &&
+test_cmp "$diff.expected" "$diff.out" &&
+test "$(iniq --diff -O keyA test.conf conf.d/10-override.conf)" = \
+    "$(printf "changed\tsection1\t0\tkeyA\ta\toverride")" &&
+test -z "$(iniq --diff multi.conf multi.conf)" &&
+test_expect_code 2 iniq --diff test.conf &&
+test_expect_code 2 iniq --diff test.conf "$diff.nonexistent"
+'
+
+test_expect_success 'Diff only the section or key in a literal path' '
+test "$(iniq --diff -p section1.keyA test.conf conf.d/10-override.conf)" = \
+    "$(printf "changed\tsection1\t0\tkeyA\ta\toverride")" &&
+test "$(iniq --diff -p .free test.conf conf.d/10-override.conf)" = \
+    "$(printf "removed\t\t0\tfree\t1\t")" &&
+test "$(iniq --diff -p section1 test.conf conf.d/10-override.conf | wc -l)" = 4 &&
+test_expect_code 0 iniq --diff -p section1.keyD test.conf conf.d/10-override.conf &&
+test_expect_code 2 iniq --diff -p section1.keyA -O keyB test.conf test.conf
+'
+
+test_expect_success 'Inherit DEFAULT keys in sections with many keys' '
+many="$SHARNESS_TRASH_DIRECTORY/many.conf" &&
+printf "[DEFAULT]\na=0\nf=0\n[s]\na=1\nb=2\nc=3\nd=4\ne=5\n" >"$many" &&
+test "$(iniq -p s. "$many")" = "f
+a
+b
+c
+d
+e" &&
+test "$(iniq -p s.a "$many")" = 1 &&
+test "$(iniq -p s.f "$many")" = 0 &&
+test "$(iniq -O f -p "s*" "$many")" = "section=s f=0"
+'
+
+test_expect_success 'Find sections where a key has a value' '
+test "$(iniq -w keyA=a test.conf)" = section1 &&
+test "$(iniq -w default=true test.conf)" = section1 &&
+test "$(iniq -d -w default=true test.conf)" = "DEFAULT
+section1" &&
+test_must_fail iniq -D -w default=true test.conf &&
+test "$(iniq -w "key*={a,b}" -f "[%s]" test.conf)" = "[section1]" &&
+test "$(iniq -p "multi" -w key2=2 multi.conf)" = multi &&
+test "$(iniq -w enabled=false wildcard.conf)" = "web-2
+db
+a*b" &&
+test "$(iniq -p "web-*" -w enabled=true wildcard.conf)" = web-1 &&
+test_must_fail iniq -w keyA=b test.conf &&
+test_must_fail iniq -w =a test.conf &&
+test_must_fail iniq -p section1.keyA -w keyA=a test.conf &&
+test_must_fail iniq -w default=true -o test.conf &&
+test_must_fail iniq -w default=true -O keyA test.conf &&
+test_must_fail iniq -p section1 -n -w default=true test.conf &&
+test_must_fail iniq -w default=true --export test.conf &&
+test_must_fail iniq -w default=true --diff test.conf test.conf
+'
+
+test_expect_success 'Set and delete keys in place' '
+edit="$SHARNESS_TRASH_DIRECTORY/edit.conf" &&
+printf "; comment\n[a]\nx = 1 ; keep\ny=2\n\n[b]\nz : 3\n" >"$edit" &&
+chmod 640 "$edit" &&
+iniq --set a.x=10 --set a.w=new --delete a.y --set b.z=Z --set c.k=v "$edit" &&
+printf "; comment\n[a]\nx = 10 ; keep\nw=new\n\n[b]\nz : Z\n\n[c]\nk=v\n" \
+    >"$edit.expected" &&
+test_cmp "$edit.expected" "$edit" &&
+test "$(stat -c %a "$edit")" = 640 &&
+test "$(printf "k=v" | iniq --set .k=w --set s.k=v)" = \
+    "$(printf "k=w\n\n[s]\nk=v")" &&
+test "$(iniq -i 1 --set multi.key1=one <multi.conf | iniq -p multi.key1 -i 1)" = one &&
+test_must_fail iniq --set a.x "$edit" &&
+test_must_fail iniq --set x=1 "$edit" &&
+test_must_fail iniq --set a.x=2 -o "$edit" &&
+test_must_fail iniq --delete a.x -O x "$edit" &&
+test_must_fail iniq --set a.x=2 -p a -n "$edit" &&
+test_must_fail iniq --set a.x=2 --export "$edit" &&
+test_cmp "$edit.expected" "$edit"
+'
+
+test_expect_success 'Reject edits that would not read back' '
+edit="$SHARNESS_TRASH_DIRECTORY/reject.conf" &&
+printf "[s]\nk = v ; %0150d\n" 0 >"$edit" &&
+cp "$edit" "$edit.expected" &&
+test_must_fail iniq --set "s.k=a ; b" "$edit" &&
+test_must_fail iniq --set "s.k=;b" "$edit" &&
+test_must_fail iniq --set "s.k=  sp  " "$edit" &&
+test_must_fail iniq --set "s. k=v" "$edit" &&
+test_must_fail iniq --set "s.;x=1" "$edit" &&
+test_must_fail iniq --set "s.#x=1" "$edit" &&
+test_must_fail iniq --set "s.[x=1" "$edit" &&
+test_must_fail iniq --set "s.a:b=1" "$edit" &&
+test_must_fail iniq --set "x]y.k=1" "$edit" &&
+test_must_fail iniq --set "s.k=$(printf "%060d" 1)" "$edit" &&
+test_cmp "$edit.expected" "$edit" &&
+test "$(ls "$SHARNESS_TRASH_DIRECTORY" | grep -c iniq-)" = 0 &&
+test "$(iniq -s = --set "s.a:b=1" <"$edit" | iniq -s = -p s.a:b)" = 1 &&
+test "$(iniq --set "s.k=a;b" <"$edit" | iniq -p s.k)" = "a;b"
+'
+
+gzip -c test.conf | iniq >/dev/null 2>&1 && test_set_prereq ZLIB
+
+test_expect_success ZLIB 'Read gzip-compressed files' '
+gz="$SHARNESS_TRASH_DIRECTORY/test.conf.gz" &&
+gzip -c test.conf >"$gz" &&
+test "$(iniq "$gz")" = "$(iniq test.conf)" &&
+test "$(iniq -o "$gz")" = "$(iniq -o test.conf)" &&
+test "$(iniq -p section1.keyA <"$gz")" = a &&
+test "$(iniq -p section1.keyA multi.conf "$gz")" = a &&
+long=$(printf "%0300d" 0) &&
+seq 3000 | sed "s/.*/[s&]\\nk=$long\\n  [c&]/" | gzip -c >"$gz.big" &&
+test $(iniq "$gz.big" | wc -l) = 6000 &&
+test "$(iniq -m -n -p "s*" <"$gz.big")" = 3000 &&
+head -c 20 "$gz" >"$gz.part" &&
+test_must_fail iniq -o "$gz.part"
+'
+
+readelf -n "$(command -v iniq)" 2>/dev/null | grep -q stapsdt &&
+    test_set_prereq USDT
+
+test_expect_success USDT 'List static tracepoints' '
+probes="$SHARNESS_TRASH_DIRECTORY/probes" &&
+readelf -n "$(command -v iniq)" | sed -n "s/^ *Name: //p" | sort -u >"$probes" &&
+printf "%s\n" output__flush parse__done parse__start query__done \
+    query__section query__start query__value section__new >"$probes.expected" &&
+test_cmp "$probes.expected" "$probes"
+'
+
+iniq --stats test.conf >/dev/null 2>&1 && test_set_prereq STATS
+
+test_expect_success STATS 'Print parse statistics' '
+test "$(iniq --stats -p section1.keyA test.conf 2>/dev/null)" = "a" &&
+iniq --stats -p section1.keyA test.conf 2>&1 >/dev/null | grep -qx "lines: 9" &&
+iniq --stats=json -o test.conf 2>&1 >/dev/null | grep -q "\"stored_pairs\":5" &&
+test "$(printf "\0x\nk=v\n" | iniq --stats -p .k 2>/dev/null)" = v
+'
+
 test_done
 
 # vim: ft=sh